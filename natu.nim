@@ -3,7 +3,7 @@ when not isMainModule:
     "Please import natu/[video, input, irq, tte, utils]".}
 
 import parseopt, strutils, strscans
-import natu/tools/[gbafix, gfxconvert, bgconvert, mmconvert, mixconvert, meminfo]
+import natu/tools/[gbafix, gfxconvert, bgconvert, mmconvert, mixconvert, meminfo, profinfo]
 
 const version = static:
   var res = "0.0.0"
@@ -29,6 +29,7 @@ Extras:
   natu mixconvert          Generate pc/sdl soundbank from a .tsv file
   natu fix <file.gba>      Fix a GBA ROM's header (logo + checksum)
   natu info <file.elf>     Show how much ROM, IWRAM and EWRAM are in use by a game.
+  natu prof <log.txt>      Summarise profiler output captured from a game's log.
   natu help                Show this dialogue
   natu help <command>      Show help for a specific command
 
@@ -60,6 +61,7 @@ proc help(p: var OptParser) =
     var helpFlag = initOptParser("--help")
     case p.key
     of "fix": gbafix(helpFlag, "natu fix")
+    of "prof": profinfo(helpFlag, "natu prof")
     else: quit(helpMsg, 0)
   else:
     quit(helpMsg, 0)
@@ -73,5 +75,6 @@ of "mmconvert": mmConvert(p, "natu mmconvert")
 of "mixconvert": mixConvert(p, "natu mixconvert")
 of "fix": gbafix(p, "natu fix")
 of "info": meminfo(p, "natu info")
+of "prof": profinfo(p, "natu prof")
 of "help": help(p)
 else: quit(helpMsg, 0)
@@ -1,5 +1,6 @@
 import natu/[utils, video, bios]
 import natu/kit/pal_manager
+export CompressionKind
 from natu/private/common import doInclude, natuOutputDir
 
 type
@@ -12,12 +13,8 @@ type
     bfScreenblock
     bfBlankTile
     bfAutoPal
-  
-  CompressionKind* = enum  # TODO: move this outta here in the future.
-    None
-    # Lz77
-    # Huff
-    Rle
+    bfDiffTiles
+    bfDiffMap
   
   BgData* = object
     kind*: BgKind
@@ -52,6 +49,25 @@ template is8bpp*(bg: Background): bool =
   bg.data.kind in {bkReg8bpp, bkAff}
 
 
+proc diffUnfilter8(dest: pointer; words: int) =
+  ## Undo an 8-bit difference filter in-place, using halfword accesses so it's safe for VRAM.
+  let d = cast[ptr UncheckedArray[uint16]](dest)
+  var acc = 0'u8
+  for i in 0..<words*2:
+    let v = d[i]
+    let lo = acc + uint8(v and 0xff)
+    acc = lo + uint8(v shr 8)
+    d[i] = lo.uint16 or (acc.uint16 shl 8)
+
+proc diffUnfilter16(dest: pointer; words: int) =
+  ## Undo a 16-bit difference filter in-place.
+  let d = cast[ptr UncheckedArray[uint16]](dest)
+  var acc = 0'u16
+  for i in 0..<words*2:
+    acc += d[i]
+    d[i] = acc
+
+
 proc loadTiles*(bg: Background; dest: pointer) {.inline.} =
   ## 
   ## Copy a background's tile image data to some location in memory.
@@ -62,11 +78,13 @@ proc loadTiles*(bg: Background; dest: pointer) {.inline.} =
   ## If your BG asset has a tileOffset specified, be sure to add that
   ## to the destination before calling this.
   ## 
-  case bg.tileComp
-  of None:
+  if bg.tileComp == None:
     memcpy32(dest, bg.imgDataPtr, bg.data.imgWords)
-  of Rle:
-    RLUnCompVram(bg.imgDataPtr, dest)
+  else:
+    decompressVram(bg.tileComp, bg.imgDataPtr, dest)
+  
+  if bfDiffTiles in bg.flags:
+    diffUnfilter8(dest, bg.data.imgWords.int)
 
 
 proc loadTiles*(bg: Background; cbb: range[0..3]) {.inline.} =
@@ -87,11 +105,16 @@ proc loadMap*(bg: Background; dest: pointer) {.inline.} =
   ## :bg:   The background asset to use.
   ## :dest: The location to copy the map data to.
   ## 
-  case bg.mapComp
-  of None:
+  if bg.mapComp == None:
     memcpy32(dest, bg.mapDataPtr, bg.data.mapWords)
-  of Rle:
-    RLUnCompVram(bg.mapDataPtr, dest)
+  else:
+    decompressVram(bg.mapComp, bg.mapDataPtr, dest)
+  
+  if bfDiffMap in bg.flags:
+    if bg.kind == bkAff:
+      diffUnfilter8(dest, bg.data.mapWords.int)
+    else:
+      diffUnfilter16(dest, bg.data.mapWords.int)
 
 
 proc loadMap*(bg: Background; sbb: range[0..31]) {.inline.} =
@@ -126,7 +149,7 @@ proc loadPal*(bg: Background; palId: range[0..15]) {.inline.} =
   ## :bg:    The background asset to use.
   ## :palId: The palette will be copied to this location in :xref:`bgPalBuf`.
   ## 
-  memcpy16(addr bgPalBuf[palId], bg.palDataPtr, bg.data.palHalfwords)
+  writeBgPal(palId, bg.palDataPtr, bg.data.palHalfwords.int)
 
 
 template load*(bgcnt: BgCnt; bg: Background) =
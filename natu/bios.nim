@@ -9,7 +9,7 @@
 ##   `GBATek <https://rust-console.github.io/gbatek-gbaonly/#biosfunctions>`_
 ##   in the meantime.
 
-import ./private/[types, common]
+import ./private/[types, common, compkind]
 
 from ./irq import IrqIndex
 from ./math import FixedT
@@ -347,6 +347,21 @@ proc Diff8bitUnFilterVram*(src: pointer; dst: pointer) {.swi:"0x17", tonc.}
 proc Diff16bitUnFilter*(src: pointer; dst: pointer) {.swi:"0x18", tonc.}
 
 
+export CompressionKind
+
+proc decompressVram*(kind: CompressionKind; src: pointer; dst: pointer) {.inline.} =
+  ## 
+  ## Decompress some data using the VRAM-safe BIOS routine for the given kind.
+  ## 
+  ## `None` is not handled here, as the size of uncompressed data isn't known.
+  ## 
+  case kind
+  of None: assert(false, "Data is not compressed.")
+  of Lz77: LZ77UnCompVram(src, dst)
+  of Huff: HuffUnComp(src, dst)
+  of Rle: RLUnCompVram(src, dst)
+
+
 # Sound
 # -----
 
@@ -1,5 +1,8 @@
 import os, strutils
 import std/compilesettings
+import ./private/compkind
+
+export CompressionKind
 
 let natuDir* = currentSourcePath().parentDir.parentDir
 
@@ -224,6 +227,12 @@ type ObjSize* = enum
 type GraphicFlag* = enum
   StrictPal
   PalOnly
+  Dedupe
+    ## Store identical frames only once, within this graphic and across other graphics.
+    ## Frames are then looked up via a table, so `imgDataPtr` no longer points to every frame.
+  DedupeFlips
+    ## Like `Dedupe`, but also match frames that are horizontally and/or vertically
+    ## flipped copies of each other. They are flipped back when copied into VRAM.
 
 var natuGraphics*: seq[string]
 
@@ -247,7 +256,8 @@ proc readGraphics*(script: static string) =
     size: ObjSize,
     bpp = 4,
     flags: set[GraphicFlag] = {},
-    strictPal = false
+    strictPal = false,
+    comp = None,
   ) =
     let path = name.absolutePath.relativePath(natuCurrentDir)
     doAssert({'\t', '\n'} notin path, path & " contains invalid characters.")
@@ -255,7 +265,9 @@ proc readGraphics*(script: static string) =
     if strictPal:
       echo "`strictPal` is deprecated, use flags={StrictPal} instead."
       flags.incl StrictPal  # legacy compatibiltiy
-    natuGraphics.add row(path, size, bpp, natuPalCounter, flags.toUInt())
+    if DedupeFlips in flags:
+      flags.incl Dedupe
+    natuGraphics.add row(path, size, bpp, natuPalCounter, flags.toUInt(), comp)
     if not natuIsSharingPal:
       inc natuPalCounter
   
@@ -289,6 +301,12 @@ type
       ## For 4bpp BGs, attempt to build a set of 16-color palettes from the image.
       ## If this flag is omitted, the PNG's own palette will be strictly followed, and
       ## each 8x8 tile in the image must only refer to colors from a single group of 16.
+    bfDiffTiles
+      ## Apply an 8-bit difference filter to the tiles before compressing them.
+      ## Can improve the compression of smooth gradients in 8bpp backgrounds.
+    bfDiffMap
+      ## Apply a difference filter to the map before compressing it.
+      ## Can improve the compression of maps made from runs of consecutive tiles.
   
   BgRegionLayout* = enum
     Chr4c
@@ -312,10 +330,6 @@ type
       ##    . . .
   
   BgRegion* = (BgRegionLayout, int, int, int, int)
-  
-  CompressionKind* = enum
-    None
-    Rle
 
 var natuBackgrounds*: seq[string]
 
@@ -355,21 +369,31 @@ proc bgConvert*(script: static string) =
 # Audio
 # -----
 
+type
+  SampleEncoding* = enum
+    ## How a sample is stored in the soundbank for PC builds (GBA builds are unaffected).
+    SampleInt16  ## 16-bit PCM
+    SampleAdpcm  ## 4-bit IMA-ADPCM, about 4x smaller than `SampleInt16` but lower quality.
+
 var
   natuSamples*: seq[string]
+  natuAdpcmSamples*: seq[string]
   natuModules*: seq[string]
 
 proc readAudio*(script: static string) =
   
   natuSamples = @[]
+  natuAdpcmSamples = @[]
   natuModules = @[]
   
   let natuCurrentDir = getCurrentDir()
   
-  proc sample(name: string) =
+  proc sample(name: string; encoding = SampleInt16) =
     let path = name.absolutePath.relativePath(natuCurrentDir)
     doAssert({'\t', '\n'} notin path, path & " contains invalid characters.")
     natuSamples.add path
+    if encoding == SampleAdpcm:
+      natuAdpcmSamples.add path
   
   proc module(name: string) =
     let path = name.absolutePath.relativePath(natuCurrentDir)
@@ -389,11 +413,20 @@ proc mmConvert*(script: static string) =
     natuModules.join(" "),
   ]
 
-proc mixConvert*(script: static string) =
+proc mixConvert*(script: static string; bindir = "") =
+  ## Build the soundbank for PC builds.
+  ## 
+  ## :bindir: Where the game's executable lives, so the soundbank can be copied next to it.
   readAudio(script)
   mkDir("output")
-  exec natuExe() & " mixconvert --script:$# --sfxdir:. --moddir:. --outdir:output $# $#" % [
+  var extraArgs: seq[string]
+  if bindir != "":
+    extraArgs.add "--bindir:" & bindir
+  for path in natuAdpcmSamples:
+    extraArgs.add "--adpcm:" & path
+  exec natuExe() & " mixconvert --script:$# --sfxdir:. --moddir:. --outdir:output $# $# $#" % [
     script,
+    extraArgs.join(" "),
     natuSamples.join(" "),
     natuModules.join(" "),
   ]
@@ -13,8 +13,15 @@
 ## - `posprintf <posprintf.html>`_ ⸺ Fast number-to-string conversion.
 ## - `tte <tte.html>`_ ⸺ Tonc Text Engine
 ## - `mgba <mgba.html>`_ ⸺ mGBA debug logging
+## - `profiler <profiler.html>`_ ⸺ Per-frame cycle counting for named zones
 ## - `maxmod <maxmod.html>`_ ⸺ Music and sound library
 ## - `legacy <legacy.html>`_ ⸺ Old C constants.
+## 
+## **Kit:**
+## 
+## - `obj_buffer <kit/obj_buffer.html>`_ ⸺ OAM shadow buffer that only copies changed objects.
+## - `obj_tile_manager <kit/obj_tile_manager.html>`_ ⸺ Allocates tiles in Obj VRAM.
+## - `pal_manager <kit/pal_manager.html>`_ ⸺ Palette buffers that only copy changed palettes.
 
 import std/compilesettings
 
@@ -30,8 +37,12 @@ when querySetting(command) in ["doc", "jsondoc"]:
   import posprintf
   import tte
   import mgba
+  import profiler
   import maxmod
   import legacy
+  import kit/obj_buffer
+  import kit/obj_tile_manager
+  import kit/pal_manager
 
 else:
   {.error:"This module is for doc gen only.".}
\ No newline at end of file
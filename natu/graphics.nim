@@ -1,15 +1,19 @@
-import natu/[video, math, utils]
+import natu/[video, math, utils, bios]
 import natu/kit/[pal_manager, obj_tile_manager]
+import natu/private/frameflip
 from natu/private/common import doInclude, natuOutputDir
 
 export pal_manager
 export obj_tile_manager
 export ObjSize
+export CompressionKind
 
 type
   GraphicFlag* = enum
     StrictPal
     PalOnly
+    Dedupe
+    DedupeFlips
   GraphicData* = object
     imgPos*: int
     palPos*: int
@@ -22,6 +26,15 @@ type
     w, h: uint8
     size*: ObjSize
     flags*: set[GraphicFlag]
+    comp*: CompressionKind
+    framePos: uint16
+
+# Entries in the frame offsets table may use the top bits to indicate
+# that the frame is stored flipped (see `Dedupe` in the graphics config).
+const
+  frameHFlip = 1'u32 shl 30
+  frameVFlip = 1'u32 shl 31
+  frameOffsetMask = frameHFlip - 1
 
 doInclude natuOutputDir & "/graphics.nim"
 
@@ -89,18 +102,37 @@ template copyPal*(dest: ptr Color | ptr Palette, g: Graphic) =
   ## 
   memcpy16(dest, g.palDataPtr, g.data.palHalfwords)
 
-template copyAllFrames*(dest: ptr Tile4 | ptr Tile8, g: Graphic) =
+template copyFrame*(dest: ptr Tile4, g: Graphic, frame: int) =
   ## 
-  ## Copy all frames of animation to a location in Object VRAM
+  ## Copy a single frame of animation to a location in Object VRAM
   ## 
-  memcpy32(dest, g.imgDataPtr, g.data.imgWords)
+  ## If the graphic is compressed, the frame will be decompressed on the fly.
+  ## If it's deduplicated, the frame will be found via the graphic's frame table.
+  ## 
+  if g.data.comp != None:
+    decompressVram(g.data.comp, g.frameDataPtr(frame), dest)
+  elif Dedupe in g.data.flags:
+    let entry = g.frameEntry(frame)
+    if (entry and not frameOffsetMask) == 0:
+      memcpy32(dest, g.frameDataPtr(frame), g.data.frameWords)
+    else:
+      copyFrameFlipped(dest, g.frameDataPtr(frame), g.w, g.h, g.bpp,
+        hflip = (entry and frameHFlip) != 0,
+        vflip = (entry and frameVFlip) != 0)
+  else:
+    let img = cast[ptr UncheckedArray[uint32]](g.imgDataPtr)
+    memcpy32(dest, addr img[g.data.frameWords.int * frame], g.data.frameWords)
 
-template copyFrame*(dest: ptr Tile4, g: Graphic, frame: int) =
+template copyAllFrames*(dest: ptr Tile4 | ptr Tile8, g: Graphic) =
   ## 
-  ## Copy a single frame of animation to a location in Object VRAM
+  ## Copy all frames of animation to a location in Object VRAM
   ## 
-  let img = cast[ptr UncheckedArray[uint32]](g.imgDataPtr)
-  memcpy32(dest, addr img[g.data.frameWords.int * frame], g.data.frameWords)
+  if g.data.comp == None and Dedupe notin g.data.flags:
+    memcpy32(dest, g.imgDataPtr, g.data.imgWords)
+  else:
+    let d = cast[ptr UncheckedArray[Tile4]](dest)
+    for i in 0..<g.numFrames:
+      copyFrame(addr d[g.frameTiles * i], g, i)
 
 template onscreen*(g: Graphic, pos: Vec2i): bool =
   ## 
@@ -129,7 +161,7 @@ proc acquireObjPal(u: var PalUsage, palData: pointer, palHalfwords: int): int {.
   if u.count == 0:
     let palId = allocObjPal()
     u.index = palId.uint
-    memcpy16(addr objPalBuf[palId], palData, palHalfwords)
+    writeObjPal(palId, palData, palHalfwords)
     result = palId
   else:
     result = u.index.int
@@ -181,7 +213,7 @@ template loadPal*(g: Graphic) =
   ## 
   ## Load palette data from a graphic into the correct slot in the Obj PAL RAM buffer.
   ## 
-  memcpy16(addr objPalBuf[getPalId(g)], g.palDataPtr, g.data.palHalfwords)
+  writeObjPal(getPalId(g), g.palDataPtr, g.data.palHalfwords.int)
 
 
 # Graphic tile allocation
@@ -202,6 +234,7 @@ template palNum*(gd: GraphicData): int = int(gd.palNum)
 template palHalfwords*(gd: GraphicData): int = int(gd.palHalfwords)
 template frames*(gd: GraphicData): int = int(gd.frames)
 template frameWords*(gd: GraphicData): int = int(gd.frameWords)
+template framePos*(gd: GraphicData): int = int(gd.framePos)
 template bpp*(gd: GraphicData): int = int(gd.bpp)
 template w*(gd: GraphicData): int = int(gd.w)
 template h*(gd: GraphicData): int = int(gd.h)
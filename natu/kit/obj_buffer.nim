@@ -0,0 +1,91 @@
+import std/bitops
+import natu/[video, utils]
+import natu/private/common
+
+when natuPlatform == "gba":
+  const numObjs = 128
+elif natuPlatform == "sdl":
+  const numObjs = 256
+else:
+  {.error: "Unknown platform " & natuPlatform.}
+
+# OAM buffer
+# ----------
+# An optional shadow copy of the object attributes in OAM.
+# 
+# Write sprites into the buffer via `setObj` (or `objBuf`) at any time during
+# the frame, then call `flushObjs` during vblank to update the real OAM.
+# 
+# Only objects which have changed since the last flush are copied.
+# `setObj` marks an object only if its attributes are actually different,
+# whereas accessing the whole buffer via `objBuf` marks every object.
+# 
+# Flushing only writes `attr0`..`attr2` of each object. The `fill` fields in OAM
+# hold the affine matrices, so those can still be written straight into `objAffMem`.
+
+var objBufData {.codegenDecl:DataInEwram.}: array[numObjs, ObjAttr]
+
+var dirtyObjs: array[numObjs div 32, uint32]  # bit `i` = object `i` needs copying.
+var oamBytes: int
+
+proc markAllObjs =
+  for w in mitems(dirtyObjs):
+    w = not 0'u32
+
+proc touchObjs: pointer {.inline.} =
+  markAllObjs()
+  addr objBufData
+
+template objBuf*: array[numObjs, ObjAttr] =
+  ## Access the OAM buffer as an array of objects.
+  cast[ptr array[numObjs, ObjAttr]](touchObjs())[]
+
+proc setObj*(i: int; obj: ObjAttr) =
+  ## 
+  ## Copy an object into the OAM buffer, marking it to be flushed if it changed.
+  ## 
+  assert(i >= 0 and i < numObjs, "Obj index out of range")
+  let dst = addr objBufData[i]
+  if dst.attr0 != obj.attr0 or dst.attr1 != obj.attr1 or dst.attr2 != obj.attr2:
+    dst[] = obj
+    dirtyObjs[i shr 5] = dirtyObjs[i shr 5] or (1'u32 shl (i and 31))
+
+proc hideObj*(i: int) =
+  ## Hide an object in the OAM buffer.
+  var obj = objBufData[i]
+  obj.hide()
+  setObj(i, obj)
+
+proc flushObjs* =
+  ## 
+  ## Copy the OAM buffer into OAM.
+  ## 
+  ## This should be called every frame during VBlank.
+  ## 
+  ## Only objects which were changed since the last flush are copied.
+  ## 
+  oamBytes = 0
+  for w in 0..<dirtyObjs.len:
+    var bits = dirtyObjs[w]
+    while bits != 0:
+      let i = w*32 + countTrailingZeroBits(bits)
+      objMem[i].setAttr(objBufData[i])
+      oamBytes += 3 * sizeof(OamUint)
+      bits = bits and (bits - 1)
+    dirtyObjs[w] = 0
+
+proc flushObjsAll* =
+  ## 
+  ## Copy the OAM buffer into OAM in full, whether or not it changed.
+  ## 
+  markAllObjs()
+  flushObjs()
+
+proc oamBytesFlushed*: int =
+  ## The number of bytes copied into OAM by the last flush.
+  oamBytes
+
+# initialisation:
+for obj in mitems(objBufData):
+  obj.hide()
+markAllObjs()
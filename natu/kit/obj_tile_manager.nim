@@ -1,10 +1,5 @@
-import natu/[memory, utils, video]
-import natu/private/common
-
-type ObjTileState {.size: 1.} = enum
-  otUnused
-  otUsed
-  otContinue
+import natu/[memory, utils, video, math]
+import natu/private/[common, tilealloc]
 
 when natuPlatform == "gba":
   const MaxObjTiles = 1024
@@ -13,10 +8,7 @@ elif natuPlatform == "sdl":
 else:
   {.error: "Unknown platform " & natuPlatform.}
 
-var objTiles {.codegenDecl:DataInEwram.}: array[MaxObjTiles+1, ObjTileState]  # length+1 for "null terminator"
-
-# Potential optimisation - keep track of the lowest guaranteed 'free' tile and only begin searching from there.
-# If some memory is freed that is lower than that tile, set it to be equal to that
+var objTiles {.codegenDecl:DataInEwram.}: TileAllocator[MaxObjTiles]
 
 proc allocObjTiles*(tiles: range[1..1024], snap: range[0..9] = 0): int =
   ## 
@@ -31,28 +23,10 @@ proc allocObjTiles*(tiles: range[1..1024], snap: range[0..9] = 0): int =
   ## snap
   ##   Quantise the allocation to the nearest ``2^snap`` tiles.
   ## 
-  var start = 0
-  var n = 0
-  while n < MaxObjTiles:
-    if objTiles[n] == otUnused:
-      if (n-start)+1 == tiles:     # do we have enough consecutive unused blocks?
-        objTiles[start] = otUsed   # mark the first block as used
-        for i in start+1 .. n:     # mark the rest of the blocks as 'continue' i.e. belonging to the start block
-          objTiles[i] = otContinue
-        return start               # return tile number
-      n += 1
-    else:
-      # broke the chain, let's start again from the next block
-      # snap to nearest 2^snap blocks to help prevent fragmentation
-      n = n shr snap
-      n += 1
-      n = n shl snap
-      start = n
-  
-  when defined(natuPanicWhenOutOfObjTiles):
-    doAssert(false, "Ran out of obj tiles")
-  else:
-    MaxObjTiles - tiles
+  ## Fails with an assertion if there isn't a big enough run of free tiles.
+  ## 
+  result = objTiles.alloc(tiles, snap)
+  doAssert(result != -1, "Ran out of obj tiles")
 
 proc paintUnused(i: int, len = 1) =
   when defined(natuShowUnusedObjTiles):
@@ -66,13 +40,36 @@ proc freeObjTiles*(tileId: int) =
   ## 
   ## Free tiles from Obj VRAM
   ## 
-  objTiles[tileId] = otUnused
-  paintUnused(tileId)
-  var i = tileId + 1
-  while objTiles[i] == otContinue:
-    objTiles[i] = otUnused
-    paintUnused(i)
-    inc(i)
+  ## Does nothing if `tileId` isn't the start of an allocation.
+  ## 
+  let n = objTiles.free(tileId)
+  if n > 0:
+    paintUnused(tileId, n)
+
+
+# Usage statistics
+# ----------------
+
+proc numFreeObjTiles*(): int =
+  ## How many tiles in Obj VRAM are currently unallocated.
+  objTiles.numFree()
+
+proc largestFreeObjTiles*(): int =
+  ## The length of the longest run of unallocated tiles in Obj VRAM.
+  ## This is the most you can allocate at once (ignoring `snap`).
+  objTiles.largestFree()
+
+proc objTileFragmentation*(): Fixed =
+  ## 
+  ## How fragmented the free space in Obj VRAM is, from 0 to 1.
+  ## 
+  ## This is the proportion of free tiles that are *not* part of the
+  ## largest free run, so 0 means all free tiles are contiguous.
+  ## 
+  let free = numFreeObjTiles()
+  if free == 0:
+    return fp(0)
+  Fixed(((free - largestFreeObjTiles()) shl fpShift) div free)
 
 
 # initialise OBJ VRAM (if we're rendering unused tiles for debug purposes.)
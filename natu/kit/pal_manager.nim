@@ -1,3 +1,4 @@
+import std/bitops
 import natu/[video, memory, utils]
 import natu/private/common
 
@@ -20,33 +21,96 @@ const numTotalColors = numBgColors + numObjColors
 # and `bg.loadPal`, or you can write directly to them.
 # 
 # Be sure to call `flushPals` during vblank to update the real palettes.
-# Or you can use `clrFadeFast` from the `video` module to blend in a certain colour while copying.
+# Or use `flushPalsFaded` to blend in a certain colour while copying.
+# 
+# Only palettes which have changed since the last flush are copied.
+# `writeBgPal` and `writeObjPal` mark just the palettes they touch, whereas
+# accessing a whole buffer (e.g. `bgPalBuf`) marks every palette in it.
+
+const numTotalPals = numBgPals + numObjPals
+const allPals = (1'u64 shl numTotalPals) - 1
 
 var colorBuf: array[numTotalColors, Color]
 
+var dirtyPals = allPals  # bit `i` = palette `i` needs copying, where obj palettes come after bg palettes.
+var palRamFade: tuple[clr: Color, alpha: int]  # what PAL RAM was faded with during the last flush.
+var palBytes: int
+
+proc touchPals(first, count: int): pointer {.inline.} =
+  dirtyPals = dirtyPals or (((1'u64 shl count) - 1) shl first)
+  addr colorBuf[first * 16]
+
 template bgPalBuf*: array[numBgPals, Palette] =
   ## Access the BG PAL RAM buffer as a table of 16-color palettes.
   ## 
   ## This is useful when working when 4bpp backgrounds.
-  cast[ptr array[numBgPals, Palette]](addr colorBuf[0])[]
+  cast[ptr array[numBgPals, Palette]](touchPals(0, numBgPals))[]
 
 template objPalBuf*: array[numObjPals, Palette] =
   ## Access the OBJ PAL RAM buffer as a table of 16-color palettes.
   ## 
   ## This is useful when working when 4bpp sprites.
-  cast[ptr array[numObjPals, Palette]](addr colorBuf[numBgColors])[]
+  cast[ptr array[numObjPals, Palette]](touchPals(numBgPals, numObjPals))[]
 
 template bgColorBuf*: array[numBgColors, Color] =
   ## Access the BG PAL RAM buffer as a single array of colors.
   ## 
   ## This is useful when working with 8bpp backgrounds, or display mode 4.
-  cast[ptr array[numBgColors, Color]](addr colorBuf[0])[]
+  cast[ptr array[numBgColors, Color]](touchPals(0, numBgPals))[]
 
 template objColorBuf*: array[numObjColors, Color] =
   ## Access the OBJ PAL RAM buffer as a single array of colors.
   ## 
   ## This is useful when working with 8bpp sprites.
-  cast[ptr array[numObjColors, Color]](addr colorBuf[numBgColors])[]
+  cast[ptr array[numObjColors, Color]](touchPals(numBgPals, numObjPals))[]
+
+proc writeBgPal*(palId: int; data: pointer; halfwords: int) =
+  ## 
+  ## Copy colors into the BG PAL RAM buffer, starting at the given palette,
+  ## and mark only the affected palettes to be flushed.
+  ## 
+  let count = (halfwords + 15) div 16
+  assert(palId >= 0 and palId + count <= numBgPals, "BG palette out of range")
+  memcpy16(touchPals(palId, count), data, halfwords)
+
+proc writeObjPal*(palId: int; data: pointer; halfwords: int) =
+  ## 
+  ## Copy colors into the OBJ PAL RAM buffer, starting at the given palette,
+  ## and mark only the affected palettes to be flushed.
+  ## 
+  let count = (halfwords + 15) div 16
+  assert(palId >= 0 and palId + count <= numObjPals, "Obj palette out of range")
+  memcpy16(touchPals(numBgPals + palId, count), data, halfwords)
+
+proc copyPals(mask: uint64; alpha: int; clr: Color) =
+  # Copy each run of consecutive palettes in `mask` into PAL RAM.
+  let palRam = cast[ptr UncheckedArray[Palette]](addr bgPalMem)
+  var mask = mask
+  while mask != 0:
+    let first = countTrailingZeroBits(mask)
+    let count = countTrailingZeroBits(not (mask shr first))
+    if alpha == 0:
+      memcpy32(addr palRam[first], addr colorBuf[first * 16], count * sizeof(Palette) div sizeof(uint32))
+    else:
+      clrFadeFast(addr colorBuf[first * 16], clr, addr palRam[first][0], (count * 16).cint, alpha.cint)
+    palBytes += count * sizeof(Palette)
+    mask = mask and not (((1'u64 shl count) - 1) shl first)
+
+proc flushPalsFaded*(clr: Color; alpha: int) =
+  ## 
+  ## Copy the palette buffers into PAL RAM while fading them towards a color, using :xref:`clrFadeFast`.
+  ## 
+  ## :clr:   The color to fade towards.
+  ## :alpha: The amount of fading, from `0` (none) to `32` (fully `clr`).
+  ## 
+  ## If the fade is the same as the last flush, only changed palettes are copied.
+  ## 
+  palBytes = 0
+  let fade: typeof(palRamFade) = if alpha == 0: (clrBlack, 0) else: (clr, alpha)
+  let mask = if fade == palRamFade: dirtyPals else: allPals
+  copyPals(mask, alpha, clr)
+  dirtyPals = 0
+  palRamFade = fade
 
 proc flushPals* {.inline.} =
   ## 
@@ -54,7 +118,22 @@ proc flushPals* {.inline.} =
   ## 
   ## This should be called every frame during VBlank.
   ## 
-  memcpy32(addr bgPalMem, addr colorBuf, sizeof(colorBuf) div sizeof(uint32))
+  ## Only palettes which were changed since the last flush are copied.
+  ## 
+  flushPalsFaded(clrBlack, 0)
+
+proc flushPalsAll* =
+  ## 
+  ## Copy the palette buffers into PAL RAM in full, whether or not they changed.
+  ## 
+  palBytes = 0
+  copyPals(allPals, 0, clrBlack)
+  dirtyPals = 0
+  palRamFade = (clrBlack, 0)
+
+proc palBytesFlushed*: int =
+  ## The number of bytes copied into PAL RAM by the last flush.
+  palBytes
 
 
 # Obj PAL RAM allocator
@@ -0,0 +1,16 @@
+## Shared by the library, the asset converters and the config script,
+## so it must not depend on anything else.
+
+type
+  CompressionKind* = enum
+    ## How an asset's data is stored in ROM, as chosen in the asset config files.
+    ## 
+    ## New kinds are added at the end so the existing ordinals stay the same.
+    None
+    Rle
+      ## BIOS run-length encoding.
+    Lz77
+      ## LZ77 as understood by the BIOS, suitable for decompressing straight into VRAM.
+    Huff
+      ## BIOS Huffman coding, 4 or 8 bits per symbol (whichever is smaller).
+      ## Only for data that's a multiple of 4 bytes, see `usableKind`.
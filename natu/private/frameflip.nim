@@ -0,0 +1,42 @@
+## Flipping frames of sprite graphics, for frames that `natu gfxconvert` has
+## deduplicated against a flipped copy of another frame (see `Dedupe` in the
+## graphics config).
+## 
+## Nothing here touches the hardware, so it can be tested on the host.
+
+func flipRow4*(x: uint32): uint32 {.inline.} =
+  ## Reverse the order of the pixels in one row of a 4bpp tile.
+  var x = ((x shr 4) and 0x0F0F0F0F'u32) or ((x and 0x0F0F0F0F'u32) shl 4)
+  x = ((x shr 8) and 0x00FF00FF'u32) or ((x and 0x00FF00FF'u32) shl 8)
+  (x shr 16) or (x shl 16)
+
+func flipBytes*(x: uint32): uint32 {.inline.} =
+  ## Reverse the order of the bytes in a word, i.e. 4 pixels of an 8bpp tile.
+  let x = ((x shr 8) and 0x00FF00FF'u32) or ((x and 0x00FF00FF'u32) shl 8)
+  (x shr 16) or (x shl 16)
+
+proc copyFrameFlipped*(dest, src: pointer; w, h, bpp: int; hflip, vflip: bool) =
+  ## Copy a frame of 4bpp or 8bpp tiles, flipping it on the way.
+  let d = cast[ptr UncheckedArray[uint32]](dest)
+  let s = cast[ptr UncheckedArray[uint32]](src)
+  let tw = w div 8
+  let th = h div 8
+  let rowWords = bpp div 4
+  let tileWords = rowWords * 8
+  for ty in 0..<th:
+    for tx in 0..<tw:
+      let sx = if hflip: tw-1-tx else: tx
+      let sy = if vflip: th-1-ty else: ty
+      let dt = (ty*tw + tx) * tileWords
+      let st = (sy*tw + sx) * tileWords
+      for row in 0..<8:
+        let sr = st + (if vflip: 7-row else: row) * rowWords
+        let dr = dt + row * rowWords
+        if rowWords == 1:
+          d[dr] = if hflip: flipRow4(s[sr]) else: s[sr]
+        elif hflip:
+          d[dr] = flipBytes(s[sr+1])
+          d[dr+1] = flipBytes(s[sr])
+        else:
+          d[dr] = s[sr]
+          d[dr+1] = s[sr+1]
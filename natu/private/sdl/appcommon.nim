@@ -19,6 +19,14 @@ proc isNil*(a: NatuSource): bool {.borrow.}
   
 ]#
 
+const NatuApiVersion* = 2
+  ## Version of the interface between the game and the host, stored in `NatuAppMem.apiVersion` by the host.
+  ## 
+  ## Version 2 hosts read the compact soundbank: `setSampleData` takes the start of the
+  ## soundbank file, and samples are located by `byteStart`/`byteEnd` and decoded according
+  ## to their `encoding`. Older hosts expect `setSampleData` to point to every sample decoded
+  ## to floats, located by `dataStart`/`dataEnd`.
+
 const NatuCbLen* = 8192*2  # twice as big as normal
 const NatuSbLen* = 1024
 const NatuSbStart* = NatuCbLen*6
@@ -49,6 +57,10 @@ type
     LoopForward
     LoopPingPong
   
+  SampleEncoding* = enum
+    SampleInt16  # 16-bit signed PCM
+    SampleAdpcm  # 4-bit IMA-ADPCM
+  
   SampleInfo* = object
     dataStart*: uint32   # measured in floats
     dataEnd*: uint32     # .. (exclusive)
@@ -57,6 +69,11 @@ type
     loopKind*: LoopKind
     loopStart*: uint32  # measured in samples (mono or stereo)
     loopEnd*: uint32    # ..
+    # added in API version 2:
+    length*: uint32      # measured in samples (mono or stereo)
+    encoding*: SampleEncoding
+    byteStart*: uint32   # measured in bytes from the start of the soundbank file
+    byteEnd*: uint32     # .. (exclusive)
   
   GamepadAxis* = enum
     axisNone
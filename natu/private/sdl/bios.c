@@ -4,6 +4,7 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #ifndef M_PI
 #    define M_PI 3.14159265358979323846
@@ -54,59 +55,248 @@ s16 ArcTan(s16 dydx) {
 s16 ArcTan2(s16 x, s16 y) {
   return (s16)(atan2f((float) y, (float) x) * Rad2gba);
 }
+
+// Memory copy/fill
+// ----------------
+// These behave like the BIOS (copies go forwards, fills repeat a single
+// unit), but hand off to memcpy/memset or simple loops that the compiler
+// can vectorize, rather than checking the mode for every element.
+
+static void copy16(const u16 *s, u16 *d, u32 count) {
+  if (d <= s || d >= s + count) {
+    // memmove gives the same result as a forward copy in these cases.
+    memmove(d, s, count * 2);
+  } else {
+    for (u32 i = 0; i < count; i++) d[i] = s[i];
+  }
+}
+
+static void copy32(const u32 *s, u32 *d, u32 count) {
+  if (d <= s || d >= s + count) {
+    memmove(d, s, count * 4);
+  } else {
+    for (u32 i = 0; i < count; i++) d[i] = s[i];
+  }
+}
+
+static void fill16(u16 v, u16 *d, u32 count) {
+  if ((v & 0xff) == (v >> 8)) {
+    memset(d, v & 0xff, count * 2);
+  } else {
+    for (u32 i = 0; i < count; i++) d[i] = v;
+  }
+}
+
+static void fill32(u32 v, u32 *d, u32 count) {
+  if (v == (v & 0xff) * 0x01010101u) {
+    memset(d, v & 0xff, count * 4);
+  } else {
+    for (u32 i = 0; i < count; i++) d[i] = v;
+  }
+}
+
 void CpuSet(const void *src, void *dst, u32 mode) {
-  if (mode & (1 << 26)) {
-    // words
-      int count = (((mode & 0x1fffff) + 7) >> 3) << 3;
-      const u32 *s = (const u32 *) src;
-      u32 *d = (u32 *) dst;
-      int i, j = 0;
-      for (i = 0; i < count; i++) {
-        d[i] = s[j];
-        if (mode & (1 << 24)) j++;
-      }
+  u32 count = mode & 0x1fffff;
+  if (mode & CS_CPY32) {
+    if (mode & CS_FILL) fill32(*(const u32 *) src, (u32 *) dst, count);
+    else copy32((const u32 *) src, (u32 *) dst, count);
   } else {
-    // halfwords
-    int count = (((mode & 0x1fffff) + 7) >> 3) << 3;
-    const u16 *s = (const u16 *) src;
-    u16 *d = (u16 *) dst;
-    int i, j = 0;
-    for (i = 0; i < count; i++) {
-      d[i] = s[j];
-      if (mode & (1 << 24)) j++;
-    }
+    if (mode & CS_FILL) fill16(*(const u16 *) src, (u16 *) dst, count);
+    else copy16((const u16 *) src, (u16 *) dst, count);
   }
 }
 void CpuFastSet(const void *src, void *dst, u32 mode) {
-  int count = (((mode & 0x1fffff) + 7) >> 3) << 3;
-  const u32 *s = (const u32 *) src;
-  u32 *d = (u32 *) dst;
-  int i, j = 0;
-  for (i = 0; i < count; i++) {
-    d[i] = s[j];
-    if (mode & (1 << 24)) j++;
-  }
+  // always words, with the count rounded up to a multiple of 8.
+  u32 count = ((mode & 0x1fffff) + 7) & ~7u;
+  if (mode & CS_FILL) fill32(*(const u32 *) src, (u32 *) dst, count);
+  else copy32((const u32 *) src, (u32 *) dst, count);
 }
 u32 BiosCheckSum(void) {
   return 0x12345678;
 }
+
+// Affine functions
+// ----------------
+
+// The sine table from the BIOS: sin(i * 2pi / 256) in 1.14 fixed point,
+// truncated rather than rounded (e.g. entry 2 is 0x323, not 0x324).
+static const s16 biosSinLut[256] = {
+  0x0000, 0x0192, 0x0323, 0x04B5, 0x0645, 0x07D5, 0x0964, 0x0AF1,
+  0x0C7C, 0x0E05, 0x0F8C, 0x1111, 0x1294, 0x1413, 0x158F, 0x1708,
+  0x187D, 0x19EF, 0x1B5D, 0x1CC6, 0x1E2B, 0x1F8B, 0x20E7, 0x223D,
+  0x238E, 0x24DA, 0x261F, 0x275F, 0x2899, 0x29CD, 0x2AFA, 0x2C21,
+  0x2D41, 0x2E5A, 0x2F6B, 0x3076, 0x3179, 0x3274, 0x3367, 0x3453,
+  0x3536, 0x3612, 0x36E5, 0x37AF, 0x3871, 0x392A, 0x39DA, 0x3A82,
+  0x3B20, 0x3BB6, 0x3C42, 0x3CC5, 0x3D3E, 0x3DAE, 0x3E14, 0x3E71,
+  0x3EC5, 0x3F0E, 0x3F4E, 0x3F84, 0x3FB1, 0x3FD3, 0x3FEC, 0x3FFB,
+  0x4000, 0x3FFB, 0x3FEC, 0x3FD3, 0x3FB1, 0x3F84, 0x3F4E, 0x3F0E,
+  0x3EC5, 0x3E71, 0x3E14, 0x3DAE, 0x3D3E, 0x3CC5, 0x3C42, 0x3BB6,
+  0x3B20, 0x3A82, 0x39DA, 0x392A, 0x3871, 0x37AF, 0x36E5, 0x3612,
+  0x3536, 0x3453, 0x3367, 0x3274, 0x3179, 0x3076, 0x2F6B, 0x2E5A,
+  0x2D41, 0x2C21, 0x2AFA, 0x29CD, 0x2899, 0x275F, 0x261F, 0x24DA,
+  0x238E, 0x223D, 0x20E7, 0x1F8B, 0x1E2B, 0x1CC6, 0x1B5D, 0x19EF,
+  0x187D, 0x1708, 0x158F, 0x1413, 0x1294, 0x1111, 0x0F8C, 0x0E05,
+  0x0C7C, 0x0AF1, 0x0964, 0x07D5, 0x0645, 0x04B5, 0x0323, 0x0192,
+  0x0000, -0x0192, -0x0323, -0x04B5, -0x0645, -0x07D5, -0x0964, -0x0AF1,
+  -0x0C7C, -0x0E05, -0x0F8C, -0x1111, -0x1294, -0x1413, -0x158F, -0x1708,
+  -0x187D, -0x19EF, -0x1B5D, -0x1CC6, -0x1E2B, -0x1F8B, -0x20E7, -0x223D,
+  -0x238E, -0x24DA, -0x261F, -0x275F, -0x2899, -0x29CD, -0x2AFA, -0x2C21,
+  -0x2D41, -0x2E5A, -0x2F6B, -0x3076, -0x3179, -0x3274, -0x3367, -0x3453,
+  -0x3536, -0x3612, -0x36E5, -0x37AF, -0x3871, -0x392A, -0x39DA, -0x3A82,
+  -0x3B20, -0x3BB6, -0x3C42, -0x3CC5, -0x3D3E, -0x3DAE, -0x3E14, -0x3E71,
+  -0x3EC5, -0x3F0E, -0x3F4E, -0x3F84, -0x3FB1, -0x3FD3, -0x3FEC, -0x3FFB,
+  -0x4000, -0x3FFB, -0x3FEC, -0x3FD3, -0x3FB1, -0x3F84, -0x3F4E, -0x3F0E,
+  -0x3EC5, -0x3E71, -0x3E14, -0x3DAE, -0x3D3E, -0x3CC5, -0x3C42, -0x3BB6,
+  -0x3B20, -0x3A82, -0x39DA, -0x392A, -0x3871, -0x37AF, -0x36E5, -0x3612,
+  -0x3536, -0x3453, -0x3367, -0x3274, -0x3179, -0x3076, -0x2F6B, -0x2E5A,
+  -0x2D41, -0x2C21, -0x2AFA, -0x29CD, -0x2899, -0x275F, -0x261F, -0x24DA,
+  -0x238E, -0x223D, -0x20E7, -0x1F8B, -0x1E2B, -0x1CC6, -0x1B5D, -0x19EF,
+  -0x187D, -0x1708, -0x158F, -0x1413, -0x1294, -0x1111, -0x0F8C, -0x0E05,
+  -0x0C7C, -0x0AF1, -0x0964, -0x07D5, -0x0645, -0x04B5, -0x0323, -0x0192,
+};
+
+// Same arithmetic as the BIOS, including the order of the shifts: pb is the
+// negation of the shifted product, which differs from shifting the negated
+// product for negative results.
+static inline void affineMatrix(s16 sx, s16 sy, u16 alpha, s16 *pa, s16 *pb, s16 *pc, s16 *pd) {
+  u32 theta = alpha >> 8;
+  s32 sin = biosSinLut[theta];
+  s32 cos = biosSinLut[(theta + 64) & 0xff];
+  *pa = (s16)((sx * cos) >> 14);
+  *pb = (s16)-(s16)((sx * sin) >> 14);
+  *pc = (s16)((sy * sin) >> 14);
+  *pd = (s16)((sy * cos) >> 14);
+}
+
 void ObjAffineSet(const ObjAffineSource *src, void *dst, s32 num, s32 offset) {
-  // swiObjAffineSet((const ObjAffineSource *)src, dst, num, offset);
+  u8 *d = (u8 *) dst;
+  for (s32 i = 0; i < num; i++) {
+    s16 pa, pb, pc, pd;
+    affineMatrix(src[i].sx, src[i].sy, src[i].alpha, &pa, &pb, &pc, &pd);
+    *(s16 *)(d) = pa;
+    *(s16 *)(d + offset) = pb;
+    *(s16 *)(d + offset * 2) = pc;
+    *(s16 *)(d + offset * 3) = pd;
+    d += offset * 4;
+  }
 }
 void BgAffineSet(const BgAffineSource *src, BgAffineDest *dst, s32 num) {
-  // swiBgAffineSet((const BgAffineSource *)src, dst, num);
+  for (s32 i = 0; i < num; i++) {
+    const BgAffineSource *s = &src[i];
+    BgAffineDest *d = &dst[i];
+    affineMatrix(s->sx, s->sy, s->alpha, &d->pa, &d->pb, &d->pc, &d->pd);
+    d->dx = s->tex_x - d->pa * s->scr_x - d->pb * s->scr_y;
+    d->dy = s->tex_y - d->pc * s->scr_x - d->pd * s->scr_y;
+  }
 }
 void BitUnPack(const void *src, void *dst, const BUP *bup) {
-  // swiBitUnPack(const void *src, dst, (const BUP *)bup);
+  const u8 *s = (const u8 *) src;
+  u32 *d = (u32 *) dst;
+  u32 srcBpp = bup->src_bpp;
+  u32 dstBpp = bup->dst_bpp;
+  u32 offset = bup->dst_ofs & 0x7fffffff;
+  u32 offsetZeros = bup->dst_ofs >> 31;
+  u32 mask = (1 << srcBpp) - 1;
+  u32 out = 0;
+  u32 outBits = 0;
+  
+  for (u32 i = 0; i < bup->src_len; i++) {
+    u32 b = s[i];
+    for (u32 bit = 0; bit < 8; bit += srcBpp) {
+      u32 v = (b >> bit) & mask;
+      if (v || offsetZeros) v += offset;
+      out |= v << outBits;
+      outBits += dstBpp;
+      if (outBits >= 32) {
+        *d++ = out;
+        out = 0;
+        outBits = 0;
+      }
+    }
+  }
+}
+
+// Decompression
+// -------------
+// Host versions of the BIOS decoders. The formats are described in GBATEK,
+// these produce the same output as the real thing but don't need to care
+// about VRAM's lack of byte writes, so Wram/Vram variants share one routine.
+
+static u32 readDecompHeader(const u8 **src) {
+  const u8 *s = *src;
+  u32 size = s[1] | (s[2] << 8) | (s[3] << 16);
+  *src = s + 4;
+  return size;
+}
+
+static void LZ77UnComp_Impl(const void *src, void *dst) {
+  const u8 *s = (const u8 *) src;
+  u8 *d = (u8 *) dst;
+  u32 size = readDecompHeader(&s);
+  u8 *end = d + size;
+  
+  while (d < end) {
+    u32 flags = *s++;
+    for (int i = 0; i < 8 && d < end; i++, flags <<= 1) {
+      if (flags & 0x80) {
+        // compressed block: 4 bits length, 12 bits displacement
+        u32 len = (s[0] >> 4) + 3;
+        u32 disp = (((s[0] & 0xf) << 8) | s[1]) + 1;
+        const u8 *from = d - disp;
+        s += 2;
+        if (len > (u32)(end - d)) len = end - d;
+        // byte-by-byte, since the source may overlap the output.
+        while (len--) *d++ = *from++;
+      } else {
+        *d++ = *s++;
+      }
+    }
+  }
 }
+
 void LZ77UnCompWram(const void *src, void *dst) {
-  // swiLZ77UnCompWram((const void *)src, dst);
+  LZ77UnComp_Impl(src, dst);
 }
 void LZ77UnCompVram(const void *src, void *dst) {
-  // swiLZ77UnCompVram((const void *)src, dst);
+  LZ77UnComp_Impl(src, dst);
 }
+
 void HuffUnComp(const void *src, void *dst) {
-  // swiHuffUnComp((const void *)src, dst);
+  const u8 *s = (const u8 *) src;
+  u32 bits = s[0] & 0xf;
+  u32 size = readDecompHeader(&s);
+  const u8 *tree = s;                            // tree table, first byte is the size
+  const u8 *root = tree + 1;
+  const u8 *stream = tree + (tree[0] + 1) * 2;  // bitstream, in 32-bit units
+  u32 *d = (u32 *) dst;
+  u32 *end = d + (size + 3) / 4;
+  
+  const u8 *node = root;
+  u32 out = 0;
+  u32 outBits = 0;
+  
+  while (d < end) {
+    u32 word = stream[0] | (stream[1] << 8) | (stream[2] << 16) | ((u32)stream[3] << 24);
+    stream += 4;
+    for (int i = 0; i < 32 && d < end; i++, word <<= 1) {
+      u32 bit = word >> 31;
+      // children are stored in pairs, relative to the pair containing this node.
+      const u8 *child = tree + ((node - tree) & ~1) + (*node & 0x3f) * 2 + 2 + bit;
+      if (*node & (0x80 >> bit)) {
+        // reached a data node
+        out |= (u32)*child << outBits;
+        outBits += bits;
+        if (outBits == 32) {
+          *d++ = out;
+          out = 0;
+          outBits = 0;
+        }
+        node = root;
+      } else {
+        node = child;
+      }
+    }
+  }
 }
 
 void RLUnComp_Impl(void *src, void *dst);
@@ -117,14 +307,34 @@ void RLUnCompWram(const void *src, void *dst) {
 void RLUnCompVram(const void *src, void *dst) {
   RLUnComp_Impl((void *)src, dst);
 }
+
+static void Diff8bitUnFilter_Impl(const void *src, void *dst) {
+  const u8 *s = (const u8 *) src;
+  u8 *d = (u8 *) dst;
+  u32 size = readDecompHeader(&s);
+  u8 acc = 0;
+  for (u32 i = 0; i < size; i++) {
+    acc += s[i];
+    d[i] = acc;
+  }
+}
+
 void Diff8bitUnFilterWram(const void *src, void *dst) {
-  // swiDiff8bitUnFilterWram((const void *)src, dst);
+  Diff8bitUnFilter_Impl(src, dst);
 }
 void Diff8bitUnFilterVram(const void *src, void *dst) {
-  // swiDiff8bitUnFilterVram((const void *)src, dst);
+  Diff8bitUnFilter_Impl(src, dst);
 }
 void Diff16bitUnFilter(const void *src, void *dst) {
-  // swiDiff16bitUnFilter((const void *)src, dst);
+  const u8 *s = (const u8 *) src;
+  u32 size = readDecompHeader(&s);
+  const u16 *s16 = (const u16 *) s;
+  u16 *d = (u16 *) dst;
+  u16 acc = 0;
+  for (u32 i = 0; i < size / 2; i++) {
+    acc += s16[i];
+    d[i] = acc;
+  }
 }
 // void SoundBias(u32 bias) {
 // }
@@ -168,8 +378,5 @@ int Mod(int num, int den) {
 // u32 DivArmAbs(int den, int num) {
 // }
 void CpuFastFill(u32 wd, void *dst, u32 count) {
-  u32 *d = (u32 *) dst;
-  for (int i = 0; i < count; i++) {
-    d[i] = wd;
-  }
+  CpuFastSet(&wd, dst, count | CS_FILL);
 }
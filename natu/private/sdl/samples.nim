@@ -0,0 +1,173 @@
+## Decoding of samples in the SDL soundbank produced by `natu mixconvert`.
+## 
+## Samples are divided into blocks of `sampleBlockLen` samples, so the mixer
+## can convert just the part it's about to play into floats, rather than
+## keeping the whole soundbank around as floats.
+## 
+## In an IMA-ADPCM block, each channel starts with a 4-byte header (the first
+## sample as an int16, the step index, and a padding byte). The headers are
+## followed by the rest of each channel's samples as 4-bit codes, low nibble
+## first. Every block is the same size except for the last one.
+## 
+## Hosts older than API version 2 can't read this format, so for them the whole
+## soundbank is decoded up front (see `hostSampleData`). The decoded floats stay
+## resident alongside the soundbank, so those hosts get no memory saving at all.
+
+import ./appcommon
+
+const
+  sampleBlockLen* = 505
+    ## Number of samples (mono or stereo) per block.
+  
+  adpcmHeaderSize = 4
+  
+  adpcmIndexTable*: array[16, int] = [
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8,
+  ]
+  
+  adpcmStepTable*: array[89, int] = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+  ]
+
+proc adpcmStep*(code: int; pred, index: var int) {.inline.} =
+  ## Apply a 4-bit IMA-ADPCM code to the decoder state.
+  let step = adpcmStepTable[index]
+  var diff = step shr 3
+  if (code and 1) != 0: diff += step shr 2
+  if (code and 2) != 0: diff += step shr 1
+  if (code and 4) != 0: diff += step
+  if (code and 8) != 0: diff = -diff
+  pred = clamp(pred + diff, -32768, 32767)
+  index = clamp(index + adpcmIndexTable[code], 0, adpcmStepTable.high)
+
+proc adpcmEncode*(pcm: openArray[int16]; channels: int): string =
+  ## Encode interleaved 16-bit samples as IMA-ADPCM, in the block layout described above.
+  let len = pcm.len div channels
+  var index = newSeq[int](channels)
+  var pred = newSeq[int](channels)
+  var first = 0
+  while first < len:
+    let n = min(sampleBlockLen, len - first)
+    for c in 0..<channels:
+      let v = pcm[first*channels + c]
+      pred[c] = v.int
+      result.add char(cast[uint16](v) and 0xff)
+      result.add char(cast[uint16](v) shr 8)
+      result.add char(index[c])
+      result.add '\0'
+    for c in 0..<channels:
+      var codes = newString(n div 2)
+      for i in 1..<n:
+        var diff = pcm[(first+i)*channels + c].int - pred[c]
+        var step = adpcmStepTable[index[c]]
+        var code = 0
+        if diff < 0:
+          code = 8
+          diff = -diff
+        if diff >= step:
+          code = code or 4
+          diff -= step
+        step = step shr 1
+        if diff >= step:
+          code = code or 2
+          diff -= step
+        step = step shr 1
+        if diff >= step:
+          code = code or 1
+        adpcmStep(code, pred[c], index[c])
+        let j = (i-1) shr 1
+        codes[j] = char(codes[j].int or (code shl (((i-1) and 1) * 4)))
+      result.add codes
+    first += n
+
+func adpcmBlockSize*(len, channels: int): int =
+  ## Size in bytes of an IMA-ADPCM block holding `len` samples.
+  channels * (adpcmHeaderSize + len div 2)
+
+func numBlocks*(smp: SampleInfo): int =
+  (smp.length.int + sampleBlockLen - 1) div sampleBlockLen
+
+proc decodeBlock*(smp: SampleInfo; data: pointer; blk: int; dest: var openArray[float32]): int =
+  ## Decode one block of a sample into `dest`, as interleaved floats in the range -1..1.
+  ## 
+  ## :data: The start of the soundbank.
+  ## :blk:  Which block to decode, from `0` to `numBlocks(smp)-1`.
+  ## 
+  ## `dest` must have room for `sampleBlockLen * smp.channels` floats.
+  ## 
+  ## Returns the number of samples decoded, which is less than `sampleBlockLen` for the last block.
+  let ch = smp.channels.int
+  let first = blk * sampleBlockLen
+  result = min(sampleBlockLen, smp.length.int - first)
+  assert(result > 0 and dest.len >= result * ch)
+  
+  let bytes = cast[ptr UncheckedArray[uint8]](cast[uint](data) + smp.byteStart.uint)
+  
+  case smp.encoding
+  of SampleInt16:
+    let src = cast[ptr UncheckedArray[int16]](addr bytes[first * ch * 2])
+    for i in 0 ..< result * ch:
+      dest[i] = src[i].float32 / 32768f
+  
+  of SampleAdpcm:
+    let start = blk * adpcmBlockSize(sampleBlockLen, ch)
+    let codesLen = result div 2
+    for c in 0 ..< ch:
+      let header = start + c * adpcmHeaderSize
+      var pred = cast[ptr int16](addr bytes[header])[].int
+      var index = bytes[header + 2].int
+      dest[c] = pred.float32 / 32768f
+      let codes = start + ch * adpcmHeaderSize + c * codesLen
+      for i in 1 ..< result:
+        let code = (bytes[codes + (i-1) shr 1].int shr (((i-1) and 1) * 4)) and 0xf
+        adpcmStep(code, pred, index)
+        dest[i * ch + c] = pred.float32 / 32768f
+
+proc decodeSamples*(smp: SampleInfo; data: pointer; first: int; dest: var openArray[float32]): int =
+  ## Decode as many samples as will fit in `dest`, starting from sample number `first`.
+  ## 
+  ## This decodes whole blocks at a time, so when streaming it's best to ask for
+  ## multiples of `sampleBlockLen`, or use `decodeBlock` directly.
+  ## 
+  ## Returns the number of samples decoded.
+  let ch = smp.channels.int
+  assert(ch in 1..2, "Only mono and stereo samples are supported.")
+  let total = min(dest.len div ch, smp.length.int - first)
+  var buf: array[sampleBlockLen * 2, float32]
+  while result < total:
+    let pos = first + result
+    let blk = pos div sampleBlockLen
+    let offset = pos - blk * sampleBlockLen
+    let n = min(decodeBlock(smp, data, blk, buf) - offset, total - result)
+    for i in 0 ..< n * ch:
+      dest[result * ch + i] = buf[offset * ch + i]
+    result += n
+
+proc decodeAll*(infos: openArray[SampleInfo]; data: pointer): seq[float32] =
+  ## Decode every sample in the soundbank to floats, each one placed at its `dataStart`.
+  var total = 0
+  for smp in infos:
+    total = max(total, smp.dataEnd.int)
+  result = newSeq[float32](total)
+  for smp in infos:
+    if smp.length > 0:
+      let n = decodeSamples(smp, data, 0, result.toOpenArray(smp.dataStart.int, smp.dataEnd.int - 1))
+      assert(n == smp.length.int)
+
+proc hostSampleData*(apiVersion: uint16; infos: openArray[SampleInfo]; data: pointer; floats: var seq[float32]): pointer =
+  ## The pointer to pass to the host's `setSampleData`, depending on which API version it implements.
+  ## 
+  ## :data:   The start of the soundbank file.
+  ## :floats: Storage for the decoded samples, for hosts that need them. It must outlive the host's use of the data.
+  if apiVersion >= NatuApiVersion:
+    data
+  else:
+    floats = decodeAll(infos, data)
+    if floats.len > 0: addr floats[0] else: nil
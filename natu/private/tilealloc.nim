@@ -0,0 +1,96 @@
+## First-fit allocation of runs of tiles, behind `natu/kit/obj_tile_manager`.
+## 
+## One bit per tile is kept, so runs of free tiles can be found a word at a
+## time. Nothing here touches the hardware, so it can be tested on the host.
+
+import std/bitops
+
+type
+  TileAllocator*[N: static int] = object
+    ## Keeps track of which of `N` tiles are allocated. `N` must be a multiple of 32.
+    used: array[N div 32, uint32]    # tile is allocated
+    starts: array[N div 32, uint32]  # tile is the first of an allocation
+    lowestFree: int                  # there are no free tiles below this one
+
+proc findBit[W: static int](bits: array[W, uint32]; start: int; value: static bool): int =
+  ## Find the first bit equal to `value` at or after `start`.
+  ## Returns `W * 32` if there is none.
+  var w = start shr 5
+  if w >= W:
+    return W * 32
+  template get(w: int): uint32 =
+    when value: bits[w] else: not bits[w]
+  var word = get(w) and ((not 0'u32) shl (start and 31))
+  while word == 0:
+    inc w
+    if w == W:
+      return W * 32
+    word = get(w)
+  (w shl 5) + countTrailingZeroBits(word)
+
+proc setBits[W: static int](bits: var array[W, uint32]; start, count: int; value: bool) =
+  ## Set or clear a run of bits, a word at a time.
+  var i = start
+  let stop = start + count
+  while i < stop:
+    let lo = i and 31
+    let n = min(32 - lo, stop - i)
+    let mask = (if n == 32: not 0'u32 else: (1'u32 shl n) - 1) shl lo
+    if value:
+      bits[i shr 5] = bits[i shr 5] or mask
+    else:
+      bits[i shr 5] = bits[i shr 5] and not mask
+    i += n
+
+proc isStart[N: static int](a: TileAllocator[N]; tileId: int): bool {.inline.} =
+  tileId in 0 ..< N and (a.starts[tileId shr 5] and (1'u32 shl (tileId and 31))) != 0
+
+proc alloc*[N: static int](a: var TileAllocator[N]; tiles: int; snap = 0): int =
+  ## Allocate a run of `tiles` tiles, starting on a multiple of `2^snap`.
+  ## 
+  ## Returns the first tile of the run, or `-1` if there's no room.
+  let align = 1 shl snap
+  var pos = a.lowestFree
+  while true:
+    # skip to the next free tile, then snap it.
+    pos = findBit(a.used, pos, false)
+    pos = (pos + align - 1) and not (align - 1)
+    if pos + tiles > N:
+      return -1
+    # do we have enough consecutive unused tiles?
+    let nextUsed = findBit(a.used, pos, true)
+    if nextUsed >= pos + tiles:
+      setBits(a.used, pos, tiles, true)
+      setBits(a.starts, pos, 1, true)
+      a.lowestFree = findBit(a.used, a.lowestFree, false)
+      return pos
+    # broke the chain, let's start again after the used tile.
+    pos = nextUsed + 1
+
+proc free*[N: static int](a: var TileAllocator[N]; tileId: int): int {.discardable.} =
+  ## Free the run of tiles starting at `tileId`.
+  ## 
+  ## Returns how many tiles were freed, which is 0 if `tileId` isn't the start of an allocation.
+  if not a.isStart(tileId):
+    return 0
+  # The allocation ends at the next free tile or the start of the next allocation.
+  let stop = min(findBit(a.used, tileId+1, false), findBit(a.starts, tileId+1, true))
+  setBits(a.starts, tileId, 1, false)
+  setBits(a.used, tileId, stop - tileId, false)
+  if tileId < a.lowestFree:
+    a.lowestFree = tileId
+  stop - tileId
+
+proc numFree*[N: static int](a: TileAllocator[N]): int =
+  ## How many tiles are currently unallocated.
+  result = N
+  for word in a.used:
+    result -= countSetBits(word)
+
+proc largestFree*[N: static int](a: TileAllocator[N]): int =
+  ## The length of the longest run of unallocated tiles.
+  var pos = findBit(a.used, a.lowestFree, false)
+  while pos < N:
+    let stop = findBit(a.used, pos, true)
+    result = max(result, stop - pos)
+    pos = findBit(a.used, stop, false)
@@ -0,0 +1,267 @@
+## Profiler
+## ========
+## Measure how many cycles are spent in different parts of your game, frame by frame.
+## 
+## Wrap the code you're interested in with `profileZone`, call `profileFrame`
+## once per frame, and every so often call `profileReport` (to print a summary)
+## or `profileDump` (to print the raw numbers for `natu prof`).
+## 
+## The profiler is disabled by default, in which case all of these compile to nothing.
+## Pass `-d:natuProfile` to enable it.
+## 
+## Example:
+## 
+## .. code-block:: nim
+## 
+##   import natu/profiler
+## 
+##   while true:
+##     profileZone "ai":
+##       updateEnemies()
+##     profileZone "draw":
+##       drawSprites()
+##     profileFrame()
+##     if keyHit(kcSelect):
+##       profileReport()
+##     VBlankIntrWait()
+## 
+## Zones may be nested, in which case the time spent in the inner zone also
+## counts towards the outer one. Zones with the same name share the same stats.
+## Zone names can't contain whitespace, as they're printed as a single word.
+## 
+## The first call to `profileFrame` only starts the clock, so anything measured
+## before it isn't recorded.
+## 
+## On GBA, cycles are counted using a pair of cascaded hardware timers (2 and 3
+## by default, same as `profileStart`, so don't use both at once). On the SDL
+## backend, cycles are derived from the system's high resolution clock, so they
+## tell you how long the code would take at the GBA's clock speed, not what it
+## would actually cost on the GBA.
+## 
+## All data lives in fixed size arrays, so the profiler never allocates.
+## 
+## Options
+## -------
+## 
+## ======================== ========================================================
+## ``-d:natuProfile``       Enable the profiler.
+## ``-d:natuProfileZones``  Max number of distinct zone names (default 16).
+## ``-d:natuProfileFrames`` How many frames of history to keep (default 64).
+## ``-d:natuProfileTimer``  First of the two timers to use on GBA (default 2).
+## ======================== ========================================================
+
+import ./private/common
+
+const natuProfile {.booldefine.} = false
+const natuProfileZones {.intdefine.} = 16
+const natuProfileFrames {.intdefine.} = 64
+const natuProfileTimer {.intdefine.} = 2
+
+const cyclesPerFrame* = 280896
+  ## Length of a frame in CPU cycles (228 scanlines of 1232 cycles each).
+
+type
+  ZoneStats* = object
+    ## Cycles spent in a zone per frame, over the frames in the history buffer.
+    ## 
+    ## Frames in which the zone didn't run at all are not counted.
+    frames*: int   ## Number of frames in which the zone ran.
+    min*: int
+    avg*: int
+    max*: int
+
+func isValidZoneName(name: string): bool =
+  if name.len == 0:
+    return false
+  for c in name:
+    if c in {' ', '\t', '\n', '\r', '\v', '\f'}:
+      return false
+  true
+
+when natuProfile:
+  
+  import ./[memory, mgba]
+  
+  when natuPlatform == "gba":
+    
+    import ./timers
+    
+    static:
+      doAssert(natuProfileTimer in 0..2, "natuProfileTimer must be 0, 1 or 2")
+    
+    proc profileCycles*(): uint32 {.inline.} =
+      ## The current value of the profiler's 32-bit cycle counter.
+      ## 
+      ## It wraps around every ~4 minutes, so only use it to measure differences.
+      let hi = tmcnt[natuProfileTimer+1].count
+      var lo = tmcnt[natuProfileTimer].count
+      let hi2 = tmcnt[natuProfileTimer+1].count
+      if hi2 != hi:
+        # The low half overflowed between reads, so take it again.
+        lo = tmcnt[natuProfileTimer].count
+      (hi2.uint32 shl 16) or lo.uint32
+    
+    tmcnt[natuProfileTimer+1].init(freq = tfCascade, active = true)
+    tmcnt[natuProfileTimer].init(freq = tf17MHz, active = true)
+  
+  elif natuPlatform == "sdl":
+    
+    import std/monotimes
+    
+    let startTime = getMonoTime().ticks
+    
+    proc profileCycles*(): uint32 =
+      ## The current value of the profiler's 32-bit cycle counter.
+      ## 
+      ## It wraps around every ~4 minutes, so only use it to measure differences.
+      let us = (getMonoTime().ticks - startTime) div 1000
+      cast[uint32](us * 16_777_216 div 1_000_000)
+  
+  else:
+    {.error: "Unknown platform " & natuPlatform.}
+  
+  type
+    FrameInfo = object
+      num: uint32
+      busy: uint32      # cycles spent in top-level zones
+      elapsed: uint32   # cycles since the previous frame
+      cycles: array[natuProfileZones, uint32]
+      calls: array[natuProfileZones, uint16]
+  
+  var zoneNames: array[natuProfileZones, cstring]
+  var numZones: int
+  
+  var history {.codegenDecl:DataInEwram.}: array[natuProfileFrames, FrameInfo]
+  var cur: FrameInfo
+  var frameNum: uint32
+  var frameStart: uint32
+  var started: bool
+  var depth: int
+  
+  proc profileRegister(name: cstring): int =
+    for i in 0..<numZones:
+      if zoneNames[i] == name:
+        return i
+    doAssert(numZones < natuProfileZones, "Too many profiler zones, try increasing natuProfileZones")
+    result = numZones
+    zoneNames[result] = name
+    inc numZones
+  
+  proc profileEnter(): uint32 {.inline.} =
+    inc depth
+    profileCycles()
+  
+  proc profileLeave(zone: int; start: uint32) {.inline.} =
+    let dt = profileCycles() - start
+    cur.cycles[zone] += dt
+    inc cur.calls[zone]
+    dec depth
+    if depth == 0:
+      cur.busy += dt
+  
+  template profileZone*(name: static string; body: untyped) =
+    ## Measure how long it takes to run `body`.
+    static: doAssert(isValidZoneName(name), "Profiler zone names can't be empty or contain whitespace: '" & name & "'")
+    var zone {.global.} = profileRegister(name.cstring)
+    let start = profileEnter()
+    try:
+      body
+    finally:
+      profileLeave(zone, start)
+  
+  proc profileFrame*() =
+    ## 
+    ## Finish the current frame, storing its measurements in the history buffer.
+    ## 
+    ## This should be called exactly once per frame, at the same point each time.
+    ## The first call only starts the clock, discarding anything measured before it.
+    ## 
+    let now = profileCycles()
+    if not started:
+      started = true
+      reset(cur)
+      frameStart = now
+      return
+    cur.num = frameNum
+    cur.elapsed = now - frameStart
+    history[frameNum mod natuProfileFrames] = cur
+    reset(cur)
+    frameStart = now
+    inc frameNum
+  
+  proc logInt(n: SomeInteger): cint =
+    # posprintf's `%l` only handles about 29 bits, so clamp rather than print garbage
+    # (e.g. for a frame that took several seconds because the game was loading).
+    when n is SomeUnsignedInt:
+      min(n.uint64, 499_999_999'u64).cint
+    else:
+      clamp(n.int, -499_999_999, 499_999_999).cint
+  
+  proc numFrames: int =
+    min(frameNum.int, natuProfileFrames)
+  
+  proc profileStats*(name: cstring): ZoneStats =
+    ## Get the min/avg/max cycles spent in a zone, over the last few frames.
+    var zone = -1
+    for i in 0..<numZones:
+      if zoneNames[i] == name:
+        zone = i
+        break
+    if zone == -1:
+      return
+    var total = 0
+    for i in 0..<numFrames():
+      let f = addr history[i]
+      if f.calls[zone] > 0:
+        let c = f.cycles[zone].int
+        total += c
+        result.min = if result.frames == 0: c else: min(result.min, c)
+        result.max = max(result.max, c)
+        inc result.frames
+    if result.frames > 0:
+      result.avg = total div result.frames
+  
+  proc profileReport*() =
+    ## 
+    ## Print the min/avg/max cycles per frame for each zone, over the last few frames.
+    ## 
+    ## Output goes to the mGBA log on GBA, or to stdout on the SDL backend.
+    ## 
+    printf("prof: %l frames", logInt(numFrames()))
+    for zone in 0..<numZones:
+      let s = profileStats(zoneNames[zone])
+      printf("prof: %s min %l avg %l max %l", zoneNames[zone], logInt(s.min), logInt(s.avg), logInt(s.max))
+  
+  proc profileDump*() =
+    ## 
+    ## Print the raw measurements for every frame in the history buffer, oldest first.
+    ## 
+    ## The output can be summarised by `natu prof`. Frames are numbered, so it's fine
+    ## for successive dumps to overlap. To capture every frame, call this at least
+    ## once every `natuProfileFrames` frames.
+    ## 
+    let n = numFrames()
+    for i in 0..<n:
+      let f = addr history[(frameNum.int - n + i) mod natuProfileFrames]
+      printf("prof frame %l %l %l", logInt(f.num), logInt(f.busy), logInt(f.elapsed))
+      for zone in 0..<numZones:
+        if f.calls[zone] > 0:
+          printf("prof zone %s %l %l", zoneNames[zone], logInt(f.cycles[zone]), logInt(f.calls[zone]))
+
+else:
+  
+  template profileZone*(name: static string; body: untyped) =
+    static: doAssert(isValidZoneName(name), "Profiler zone names can't be empty or contain whitespace: '" & name & "'")
+    body
+  
+  template profileFrame*() =
+    discard
+  
+  template profileStats*(name: cstring): ZoneStats =
+    ZoneStats()
+  
+  template profileReport*() =
+    discard
+  
+  template profileDump*() =
+    discard
@@ -74,7 +74,7 @@ type
   FnRect* = proc (dst: Surface; left, top, right, bottom: cint; clr: uint32) {.nimcall.}
   FnFrame* = proc (dst: Surface; left, top, right, bottom: cint; clr: uint32) {.nimcall.}
   FnBlit* = proc (dst: Surface; dstX, dstY: cint; width, height: cuint, src: Surface; srcX, srcY: cint) {.nimcall.}
-  FnFlood* = proc (dst: Surface; x, y: cint; clr: uint32) {.nimcall.}
+  FnFlood* = proc (dst: Surface; x, y: cint; clr: uint32): bool {.nimcall.}
   
   SurfaceProcTab* {.importc: "TSurfaceProcTab", tonc, bycopy.} = object
     ## Rendering procedure table
@@ -88,6 +88,11 @@ type
     frame*: FnFrame
     blit*: FnBlit
     flood*: FnFlood
+  
+  FloodSpan* {.importc: "TFloodSpan", tonc, bycopy.} = object
+    ## A pending span of pixels, used as working space by `floodfill`.
+    left, right: int16
+    y, dy: int16
 
 
 # Global Surfaces
@@ -286,13 +291,28 @@ proc blit*(dst: SurfaceBmp16; dstX, dstY: cint; width, height: cuint; src: Surfa
   ## .. note::
   ##    The rectangle will be clipped to both `src` and `dst`.
 
-proc floodfill*(dst: SurfaceBmp16; x, y: cint; clr: uint32) {.importc: "sbmp16_floodfill", tonc.}
+proc floodfill*(dst: SurfaceBmp16; x, y: cint; clr: uint32): bool {.importc: "sbmp16_floodfill", tonc, discardable.}
   ## Floodfill an area of the same color with new color `clr`.
   ## 
   ## :dst:  Destination surface.
   ## :x:    X-coordinate.
   ## :y:    Y-coordinate;
   ## :clr:  Color.
+  ## 
+  ## Returns `false` if parts of the area may have been left unfilled.
+  ## 
+  ## .. note::
+  ##    Pending spans are kept in a shared buffer with room for 256 of them. Very intricate
+  ##    areas can need more than that, in which case pass your own `stack` instead.
+
+proc floodfillEx(dst: SurfaceBmp16; x, y: cint; clr: uint32; stack: ptr FloodSpan; size: cuint): bool {.importc: "sbmp16_floodfill_ex", tonc.}
+
+proc floodfill*(dst: SurfaceBmp16; x, y: cint; clr: uint32; stack: var openArray[FloodSpan]): bool {.inline.} =
+  ## Floodfill an area of the same color with new color `clr`, using `stack` to hold pending spans.
+  ## 
+  ## Returns `false` if `stack` ran out, in which case parts of the area may be left unfilled.
+  assert(stack.len > 0)
+  floodfillEx(dst, x, y, clr, addr stack[0], stack.len.cuint)
 
 
 # 8bpp bitmap surfaces
@@ -388,13 +408,28 @@ proc blit*(dst: SurfaceBmp8; dstX, dstY: cint, width, height: cuint; src: Surfac
   ## .. note::
   ##    The rectangle will be clipped to both `src` and `dst`.
 
-proc floodfill*(dst: SurfaceBmp8; x, y: cint; clr: uint32) {.importc: "sbmp8_floodfill", tonc.}
+proc floodfill*(dst: SurfaceBmp8; x, y: cint; clr: uint32): bool {.importc: "sbmp8_floodfill", tonc, discardable.}
   ## Floodfill an area of the same color with new color `clr`.
   ## 
   ## :dst:  Destination surface.
   ## :x:    X-coordinate.
   ## :y:    Y-coordinate;
   ## :clr:  Color.
+  ## 
+  ## Returns `false` if parts of the area may have been left unfilled.
+  ## 
+  ## .. note::
+  ##    Pending spans are kept in a shared buffer with room for 256 of them. Very intricate
+  ##    areas can need more than that, in which case pass your own `stack` instead.
+
+proc floodfillEx(dst: SurfaceBmp8; x, y: cint; clr: uint32; stack: ptr FloodSpan; size: cuint): bool {.importc: "sbmp8_floodfill_ex", tonc.}
+
+proc floodfill*(dst: SurfaceBmp8; x, y: cint; clr: uint32; stack: var openArray[FloodSpan]): bool {.inline.} =
+  ## Floodfill an area of the same color with new color `clr`, using `stack` to hold pending spans.
+  ## 
+  ## Returns `false` if `stack` ran out, in which case parts of the area may be left unfilled.
+  assert(stack.len > 0)
+  floodfillEx(dst, x, y, clr, addr stack[0], stack.len.cuint)
 
 
 # 4bpp tiled surfaces, column major
@@ -489,7 +524,7 @@ proc blit*(dst: SurfaceChr4c; dstX, dstY: cint; width, height: cuint; src: Surfa
   ## .. note::
   ##    The rectangle will be clipped to both `src` and `dst`.
 
-proc floodfill*(dst: SurfaceChr4c; x, y: cint; clr: uint32) {.importc: "schr4c_floodfill", tonc.}
+proc floodfill*(dst: SurfaceChr4c; x, y: cint; clr: uint32): bool {.importc: "schr4c_floodfill", tonc, discardable.}
   ## Floodfill an area of the same color with new color `clr`.
   ## 
   ## :dst:  Destination surface.
@@ -497,8 +532,20 @@ proc floodfill*(dst: SurfaceChr4c; x, y: cint; clr: uint32) {.importc: "schr4c_f
   ## :y:    Y-coordinate;
   ## :clr:  Color.
   ## 
+  ## Returns `false` if parts of the area may have been left unfilled.
+  ## 
   ## .. note::
-  ##    This routines is probably very, very slow. 
+  ##    Pending spans are kept in a shared buffer with room for 256 of them. Very intricate
+  ##    areas can need more than that, in which case pass your own `stack` instead.
+
+proc floodfillEx(dst: SurfaceChr4c; x, y: cint; clr: uint32; stack: ptr FloodSpan; size: cuint): bool {.importc: "schr4c_floodfill_ex", tonc.}
+
+proc floodfill*(dst: SurfaceChr4c; x, y: cint; clr: uint32; stack: var openArray[FloodSpan]): bool {.inline.} =
+  ## Floodfill an area of the same color with new color `clr`, using `stack` to hold pending spans.
+  ## 
+  ## Returns `false` if `stack` ran out, in which case parts of the area may be left unfilled.
+  assert(stack.len > 0)
+  floodfillEx(dst, x, y, clr, addr stack[0], stack.len.cuint)
 
 # Additional routines
 
@@ -594,6 +641,29 @@ proc frame*(dst: SurfaceChr4r; left, top, right, bottom: cint; clr: uint32) {.im
   ## .. note::
   ##    Does normalization, but not bounds checks.
 
+proc floodfill*(dst: SurfaceChr4r; x, y: cint; clr: uint32): bool {.importc: "schr4r_floodfill", tonc, discardable.}
+  ## Floodfill an area of the same color with new color `clr`.
+  ## 
+  ## :dst:  Destination surface.
+  ## :x:    X-coordinate.
+  ## :y:    Y-coordinate;
+  ## :clr:  Color.
+  ## 
+  ## Returns `false` if parts of the area may have been left unfilled.
+  ## 
+  ## .. note::
+  ##    Pending spans are kept in a shared buffer with room for 256 of them. Very intricate
+  ##    areas can need more than that, in which case pass your own `stack` instead.
+
+proc floodfillEx(dst: SurfaceChr4r; x, y: cint; clr: uint32; stack: ptr FloodSpan; size: cuint): bool {.importc: "schr4r_floodfill_ex", tonc.}
+
+proc floodfill*(dst: SurfaceChr4r; x, y: cint; clr: uint32; stack: var openArray[FloodSpan]): bool {.inline.} =
+  ## Floodfill an area of the same color with new color `clr`, using `stack` to hold pending spans.
+  ## 
+  ## Returns `false` if `stack` ran out, in which case parts of the area may be left unfilled.
+  assert(stack.len > 0)
+  floodfillEx(dst, x, y, clr, addr stack[0], stack.len.cuint)
+
 # Additional routines
 
 proc prepMap*(srf: SurfaceChr4r; map: ptr ScrEntry | ptr UncheckedArray[ScrEntry]; se0: ScrEntry) {.importc: "schr4r_prep_map", tonc.}
@@ -1,7 +1,7 @@
 import strutils, strformat, parseopt, strscans, algorithm, marshal
-import options, os, times
+import options, os
 import trick
-import ./common
+import ./common, ./compression
 
 type
   BgKind = enum
@@ -13,10 +13,8 @@ type
     bfScreenblock
     bfBlankTile
     bfAutoPal
-  
-  CompressionKind = enum
-    None
-    Rle
+    bfDiffTiles
+    bfDiffMap
   
   BgRow = object
     ## Just the stuff parsed from the tsv
@@ -171,7 +169,7 @@ proc applyOffsets(bgAff: var BgAff; flags: set[BgFlag]; palOffset, tileOffset: i
         doAssert(n in 0..255, &"tileOffset of {tileOffset} pushes tile {id} outside the range 0..255")
       id = n.uint8
 
-proc writeBackgroundC(f: File; name, img, map, pal: string; data: BgData) =
+proc writeBackgroundC(f: File; name, hash, img, map, pal: string; data: BgData) =
   include "templates/background.c.template"
 
 proc writeBackgroundsC(f: File; bgRows: seq[BgRow]) =
@@ -181,20 +179,146 @@ proc writeBackgroundsNim(f: File; bgRows: seq[BgRow]; bgDatas: seq[BgData]) =
   include "templates/backgrounds.nim.template"
 
 
-proc bgConvert*(tsvPath, script, indir, outdir: string) =
+type
+  BgResult = object
+    ## The output of converting a single background on a worker thread.
+    img, map, pal: string
+    data: BgData
+    log: string
+
+const cacheVersion = "1"  # bump this if the conversion or the format of the .c files changes.
+
+proc convertBg(row: BgRow): BgResult {.gcsafe.} =
+  ## Convert one background. This runs on a worker thread, so everything it
+  ## needs comes in through `row` and everything it makes goes out through
+  ## the result, it doesn't touch any globals.
+  ## 
+  ## The only calls that the compiler can't prove to be GC-safe are trick's
+  ## PNG loaders. Those only read the file they're given and return a new
+  ## object, so they're wrapped in `cast(gcsafe)` one by one.
+  
+  if row.regions.len > 0:
+    doAssert row.kind == bkReg4bpp,
+      "Regions can only be used with 4bpp backgrounds."
+  
+  var w, h: int
+  var img, map, pal: string
+  
+  case row.kind
+  of bkReg4bpp:
+    var bg4: Bg4
+    {.cast(gcsafe).}:
+      bg4 = loadBg4(
+        row.pngPath,
+        indexed = (bfAutoPal notin row.flags),
+        firstBlank = (bfBlankTile in row.flags),
+      )
+    for region in row.regions:
+      bg4.applyRegion(region)
+    bg4.applyOffsets(row.flags, row.palOffset, row.tileOffset)
+    (w, h) = (bg4.w, bg4.h)
+    
+    if row.regions.len > 0 and bfScreenblock in row.flags:
+      doAssert w == 32, "Regions cannot be used with backgrounds arranged into screenblocks that are wider than 1 screenblock."
+    
+    img = bg4.img.toBytes()
+    pal = joinPalettes(bg4.pals).toBytes()
+    map = if bfScreenblock in row.flags:
+            bg4.map.toScreenblocks(bg4.w).toBytes()
+          else:
+            bg4.map.toBytes()
+  
+  of bkReg8bpp:
+    
+    doAssert(bfAutoPal notin row.flags, "Auto palette reduction is for 4bpp backgrounds only.")
+    
+    var bg8: Bg8
+    {.cast(gcsafe).}:
+      bg8 = loadBg8(
+        row.pngPath,
+        firstBlank = (bfBlankTile in row.flags),
+      )
+    bg8.applyOffsets(row.flags, row.palOffset, row.tileOffset)
+    (w, h) = (bg8.w, bg8.h)
+    img = bg8.img.toBytes()
+    pal = bg8.pal.toBytes()
+    map = if bfScreenblock in row.flags:
+            bg8.map.toScreenblocks(bg8.w).toBytes()
+          else:
+            bg8.map.toBytes()
+  
+  of bkAff:
+    doAssert(bfScreenblock notin row.flags, "Affine BGs don't use screenblocks.")
+    doAssert(bfAutoPal notin row.flags, "Auto palette reduction is for 4bpp backgrounds only.")
+    
+    var bgAff: BgAff
+    {.cast(gcsafe).}:
+      bgAff = loadBgAff(
+        row.pngPath,
+        firstBlank = (bfBlankTile in row.flags),
+      )
+    bgAff.applyOffsets(row.flags, row.palOffset, row.tileOffset)
+    (w, h) = (bgAff.w, bgAff.h)
+    img = bgAff.img.toBytes()
+    pal = bgAff.pal.toBytes()
+    map = bgAff.map.toBytes()
+  
+  # Decided up front, as the kind ends up in the generated data.
+  let tileComp = usableKind(row.tileComp, img.len)
+  let mapComp = usableKind(row.mapComp, map.len)
+  
+  result.data = BgData(
+    kind: row.kind,
+    w: w, h: h,
+    imgWords: (img.len div 4).uint16,
+    mapWords: (map.len div 4).uint16,
+    palHalfwords: (pal.len div 2).uint16,
+    palOffset: row.palOffset.uint16,
+    tileOffset: row.tileOffset.uint16,
+    flags: row.flags,
+    regions: row.regions,
+    tileComp: tileComp,
+    mapComp: mapComp
+  )
+  
+  # filtering
+  if bfDiffTiles in row.flags:
+    doAssert(row.tileComp != None, "bfDiffTiles is only useful alongside tile compression.")
+    img = diffFilter(img, 1)
+  
+  if bfDiffMap in row.flags:
+    doAssert(row.mapComp != None, "bfDiffMap is only useful alongside map compression.")
+    map = diffFilter(map, if row.kind == bkAff: 1 else: 2)
   
+  # compression
+  if tileComp != None:
+    let oldLen = img.len
+    img = compress(img, tileComp)
+    result.log.add ratioInfo("tiles", tileComp, oldLen, img.len)
+  
+  if mapComp != None:
+    let oldLen = map.len
+    map = compress(map, mapComp)
+    result.log.add ratioInfo("map", mapComp, oldLen, map.len)
+  
+  result.img = img
+  result.map = map
+  result.pal = pal
+
+
+proc bgConvert*(tsvPath, script, indir, outdir: string) =
+
   var bgRows: seq[BgRow]
+  var bgHashes: seq[string]
   
   let outputBgDir = outdir / "backgrounds"
   let outputCPath = outdir / "backgrounds.c"
   let outputNimPath = outdir / "backgrounds.nim"
-  
-  var newestModifiedIn = getLastModificationTime(script)
-  var oldestModifiedOut = oldest(outputCPath, outputNimPath, outputBgDir)
+  let outputHashPath = outdir / "backgrounds.hash"
   
   createDir(outputBgDir)
   
-  # parse items from .tsv and check their modification dates
+  # parse items from .tsv and hash their contents
   
   for row in tsvRows(tsvPath):
     
@@ -203,7 +327,6 @@ proc bgConvert*(tsvPath, script, indir, outdir: string) =
     
     let pngPath = indir / dir / name & ".png"
     doAssert(fileExists(pngPath), "No such file " & pngPath)
-    newestModifiedIn = newest(newestModifiedIn, pngPath, pngPath.parentDir)
     
     let bgName = "bg" & name.toCamelCase(firstUpper=true)
     bgRows.add BgRow(
@@ -217,149 +340,58 @@ proc bgConvert*(tsvPath, script, indir, outdir: string) =
       tileComp: parseEnum[CompressionKind](row[6]),
       mapComp: parseEnum[CompressionKind](row[7])
     )
-    oldestModifiedOut = oldest(oldestModifiedOut, outputBgDir / bgName & ".c")
+    bgHashes.add contentHash([pngPath], cacheVersion & "\n" & row.join("\t"))
   
-  # regenerate the output files if any input files have changed:
+  # Each BG's .c file starts with the hash of its inputs, followed by the
+  # properties from last time it was converted. If the hash still matches,
+  # the BG can be reused as-is. Otherwise convert it on a worker thread.
   
-  if newestModifiedIn > oldestModifiedOut:
-    
+  var bgDatas = newSeq[BgData](bgRows.len)
+  var pending: seq[int]
+  var pendingRows: seq[BgRow]
+  
+  for i, row in bgRows:
+    let bgCPath = outputBgDir / row.name & ".c"
+    var cached = false
+    if fileExists(bgCPath):
+      withFile bgCPath, fmRead:
+        file.setFilePos(3)
+        let parts = file.readLine().split(' ', maxsplit=1)
+        if parts.len == 2 and parts[0] == bgHashes[i]:
+          bgDatas[i] = to[BgData](parts[1])
+          cached = true
+    if not cached:
+      pending.add i
+      pendingRows.add row
+  
+  if pending.len > 0:
     echo "Converting backgrounds:"
-    
-    var bgDatas: seq[BgData]
-    
-    for row in bgRows:
-      
-      let bgCPath = outputBgDir / row.name & ".c"
-      
-      var data: BgData
-      var convert = false
-      
-      if fileExists(bgCPath):
-        if getLastModificationTime(row.pngPath) > getLastModificationTime(bgCPath):
-          convert = true
-        else:
-          # re-read properties from last time we converted this BG
-          withFile bgCPath, fmRead:
-            file.setFilePos(3)
-            data = to[BgData](file.readLine())
-            convert =
-              row.kind != data.kind or
-              row.flags != data.flags or
-              row.palOffset != data.palOffset.int or
-              row.tileOffset != data.tileOffset.int or
-              row.regions != data.regions or
-              row.tileComp != data.tileComp or
-              row.mapComp != data.mapComp
-      else:
-        convert = true
-      
-      if convert:
-        echo row.pngPath
-
-        # convert the BG
-        
-        if row.regions.len > 0:
-          doAssert row.kind == bkReg4bpp,
-            "Regions can only be used with 4bpp backgrounds."
-        
-        var w, h: int
-        var img, map, pal: string
-        
-        case row.kind
-        of bkReg4bpp:
-          var bg4 = loadBg4(
-            row.pngPath,
-            indexed = (bfAutoPal notin row.flags),
-            firstBlank = (bfBlankTile in row.flags),
-          )
-          for region in row.regions:
-            bg4.applyRegion(region)
-          bg4.applyOffsets(row.flags, row.palOffset, row.tileOffset)
-          (w, h) = (bg4.w, bg4.h)
-          
-          if row.regions.len > 0 and bfScreenblock in row.flags:
-            doAssert w == 32, "Regions cannot be used with backgrounds arranged into screenblocks that are wider than 1 screenblock."
-          
-          img = bg4.img.toBytes()
-          pal = joinPalettes(bg4.pals).toBytes()
-          map = if bfScreenblock in row.flags:
-                  bg4.map.toScreenblocks(bg4.w).toBytes()
-                else:
-                  bg4.map.toBytes()
-        
-        of bkReg8bpp:
-          
-          doAssert(bfAutoPal notin row.flags, "Auto palette reduction is for 4bpp backgrounds only.")
-          
-          var bg8 = loadBg8(
-            row.pngPath,
-            firstBlank = (bfBlankTile in row.flags),
-          )
-          bg8.applyOffsets(row.flags, row.palOffset, row.tileOffset)
-          (w, h) = (bg8.w, bg8.h)
-          img = bg8.img.toBytes()
-          pal = bg8.pal.toBytes()
-          map = if bfScreenblock in row.flags:
-                  bg8.map.toScreenblocks(bg8.w).toBytes()
-                else:
-                  bg8.map.toBytes()
-        
-        of bkAff:
-          doAssert(bfScreenblock notin row.flags, "Affine BGs don't use screenblocks.")
-          doAssert(bfAutoPal notin row.flags, "Auto palette reduction is for 4bpp backgrounds only.")
-          
-          var bgAff = loadBgAff(
-            row.pngPath,
-            firstBlank = (bfBlankTile in row.flags),
-          )
-          bgAff.applyOffsets(row.flags, row.palOffset, row.tileOffset)
-          (w, h) = (bgAff.w, bgAff.h)
-          img = bgAff.img.toBytes()
-          pal = bgAff.pal.toBytes()
-          map = bgAff.map.toBytes()
-        
-        # update and write data
-        data = BgData(
-          kind: row.kind,
-          w: w, h: h,
-          imgWords: (img.len div 4).uint16,
-          mapWords: (map.len div 4).uint16,
-          palHalfwords: (pal.len div 2).uint16,
-          palOffset: row.palOffset.uint16,
-          tileOffset: row.tileOffset.uint16,
-          flags: row.flags,
-          regions: row.regions,
-          tileComp: row.tileComp,
-          mapComp: row.mapComp
-        )
-        
-        # compression
-        case row.tileComp
-        of None: discard
-        of Rle:
-          let oldLen = img.len
-          img = rleCompress(img)
-          if img.len >= oldLen:
-            echo "Warning, tile data got bigger."
-        
-        case row.mapComp
-        of None: discard
-        of Rle:
-          let oldLen = map.len
-          map = rleCompress(map)
-          if map.len >= oldLen:
-            echo "Warning, map data got bigger."
-        
-        withFile bgCPath, fmWrite:
-          file.writeBackgroundC(row.name, img, map, pal, data)
-      
-      # push to list
-      bgDatas.add(data)
-    
+  
+  # the results come back in order, so the output is deterministic.
+  let converted = parallelMap(pendingRows, convertBg)
+  for j, i in pending:
+    let res = converted[j]
+    let row = bgRows[i]
+    echo row.pngPath
+    stdout.write res.log
+    bgDatas[i] = res.data
+    withFile outputBgDir / row.name & ".c", fmWrite:
+      file.writeBackgroundC(row.name, bgHashes[i], res.img, res.map, res.pal, res.data)
+  
+  # regenerate the combined output files if anything has changed:
+  
+  let allHash = stableHash(bgHashes)
+  
+  if pending.len > 0 or
+      not fileExists(outputCPath) or
+      not fileExists(outputNimPath) or
+      not fileExists(outputHashPath) or
+      readFile(outputHashPath) != allHash:
     withFile outputCPath, fmWrite:
       file.writeBackgroundsC(bgRows)
     withFile outputNimPath, fmWrite:
       file.writeBackgroundsNim(bgRows, bgDatas)
+    writeFile(outputHashPath, allHash)
   
   else:
     echo "Skipping backgrounds."
@@ -1,4 +1,5 @@
-import os, times, streams, parsecsv
+import os, times, streams, parsecsv, strutils
+import std/[typedthreads, atomics, cpuinfo]
 
 template withFile*(filename: string, mode: FileMode, body: untyped) =
   block:
@@ -34,3 +35,69 @@ proc oldest*(times: varargs[Time, toTime]): Time =
   result = times[0]
   for t in times[1..^1]:
     if t < result: result = t
+
+
+const fnvOffset = 0xcbf29ce484222325'u64
+const fnvPrime = 0x100000001b3'u64
+
+proc fnvMix(h: var uint64; s: string) =
+  # The length goes first, so that e.g. ["ab", "c"] and ["a", "bc"] differ.
+  var n = s.len.uint64
+  for i in 0..7:
+    h = (h xor (n and 0xff)) * fnvPrime
+    n = n shr 8
+  for c in s:
+    h = (h xor c.uint64) * fnvPrime
+
+proc stableHash*(parts: openArray[string]): string =
+  ## A 64-bit FNV-1a hash of some strings, as 16 hex digits.
+  ## 
+  ## Unlike `std/hashes`, this gives the same result with every Nim version
+  ## and platform, so it can be used to name files that outlive the build.
+  var h = fnvOffset
+  for s in parts:
+    h.fnvMix s
+  toHex(h.int64)
+
+proc contentHash*(files: openArray[string]; extra: string): string =
+  ## Hash the contents of some input files along with any other data
+  ## that affects how they are converted (e.g. a row from a .tsv file).
+  var parts: seq[string]
+  for f in files:
+    parts.add readFile(f)
+  parts.add extra
+  stableHash(parts)
+
+
+type WorkQueue[T, R] = object
+  inputs: ptr UncheckedArray[T]
+  results: ptr UncheckedArray[R]
+  len: int
+  next: Atomic[int]  # index of the next input that no worker has taken yet
+  fn: proc (x: T): R {.nimcall, gcsafe.}
+
+proc worker[T, R](q: ptr WorkQueue[T, R]) {.thread.} =
+  while true:
+    let i = q.next.fetchAdd(1)
+    if i >= q.len: break
+    q.results[i] = q.fn(q.inputs[i])
+
+proc parallelMap*[T, R](inputs: seq[T]; fn: proc (x: T): R {.nimcall, gcsafe.}): seq[R] =
+  ## Call `fn` on every input, spread over one thread per CPU core,
+  ## and return the results in the same order as the inputs.
+  ## 
+  ## Each worker takes the next input from a shared counter until there are
+  ## none left, so one slow input doesn't hold up the others.
+  result = newSeq[R](inputs.len)
+  if inputs.len == 0:
+    return
+  var q = WorkQueue[T, R](
+    inputs: cast[ptr UncheckedArray[T]](unsafeAddr inputs[0]),
+    results: cast[ptr UncheckedArray[R]](addr result[0]),
+    len: inputs.len,
+    fn: fn,
+  )
+  var threads = newSeq[Thread[ptr WorkQueue[T, R]]](clamp(countProcessors(), 1, inputs.len))
+  for t in mitems(threads):
+    createThread(t, worker[T, R], addr q)
+  joinThreads(threads)
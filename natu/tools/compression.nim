@@ -0,0 +1,339 @@
+## Compressors producing data in the formats understood by the GBA BIOS
+## decompression routines (see GBATEK for format details).
+## 
+## RLE is provided by `trick`, the rest live here.
+
+import std/[strutils, tables, algorithm]
+import trick
+import ../private/compkind
+
+export CompressionKind
+
+const
+  lz77HeaderTag = 0x10
+  huffHeaderTag = 0x20
+
+proc addHeader(s: var string; tag: int; size: int) =
+  doAssert(size < (1 shl 24), "Data is too large to be compressed (" & $size & " bytes)")
+  s.add chr(tag)
+  s.add chr(size and 0xff)
+  s.add chr((size shr 8) and 0xff)
+  s.add chr((size shr 16) and 0xff)
+
+proc padToWord(s: var string) =
+  while (s.len mod 4) != 0:
+    s.add '\0'
+
+
+# LZ77
+# ----
+
+proc lz77Compress*(data: string): string =
+  ## 
+  ## Compress data in the format used by `LZ77UnCompWram` and `LZ77UnCompVram`.
+  ## 
+  ## Matches are never closer than 2 bytes, so the output is always safe
+  ## to decompress straight into VRAM.
+  ## 
+  const
+    minLen = 3
+    maxLen = 18
+    minDist = 2     # VRAM can't be written a byte at a time.
+    maxDist = 4096
+    maxChain = 128  # how many previous occurrences to check before giving up.
+  
+  let n = data.len
+  result.addHeader(lz77HeaderTag, n)
+  
+  # Hash chains: `last` maps 3 byte sequences to their most recent position,
+  # and `prev` links each position to the previous one with the same bytes.
+  var last = initTable[int, int]()
+  var prev = newSeq[int](n)
+  var inserted = 0
+  
+  template key(p: int): int =
+    ord(data[p]) or (ord(data[p+1]) shl 8) or (ord(data[p+2]) shl 16)
+  
+  var i = 0
+  while i < n:
+    let flagPos = result.len
+    var flags = 0
+    result.add '\0'
+    
+    for b in 0..<8:
+      if i >= n: break
+      
+      while inserted < i:
+        if inserted + 2 < n:
+          let k = key(inserted)
+          prev[inserted] = last.getOrDefault(k, -1)
+          last[k] = inserted
+        inc inserted
+      
+      var bestLen, bestDist = 0
+      if i + 2 < n:
+        var p = last.getOrDefault(key(i), -1)
+        var chain = 0
+        while p >= 0 and i - p <= maxDist and chain < maxChain:
+          let dist = i - p
+          if dist >= minDist:
+            let m = min(maxLen, n - i)
+            var matchLen = 0
+            while matchLen < m and data[p+matchLen] == data[i+matchLen]:
+              inc matchLen
+            if matchLen > bestLen:
+              bestLen = matchLen
+              bestDist = dist
+              if matchLen == maxLen: break
+          p = prev[p]
+          inc chain
+      
+      if bestLen >= minLen:
+        flags = flags or (0x80 shr b)
+        let d = bestDist - 1
+        result.add chr(((bestLen - minLen) shl 4) or (d shr 8))
+        result.add chr(d and 0xff)
+        inc i, bestLen
+      else:
+        result.add data[i]
+        inc i
+    
+    result[flagPos] = chr(flags)
+  
+  result.padToWord()
+
+
+# Huffman
+# -------
+
+type
+  HuffNode = ref object
+    freq: int
+    sym: int           ## Only meaningful for leaves.
+    children: array[2, HuffNode]
+    internalCount: int ## Number of internal nodes in this subtree.
+
+func isLeaf(n: HuffNode): bool = n.children[0] == nil
+
+proc buildCodes(n: HuffNode; code: seq[bool]; codes: var seq[seq[bool]]) =
+  if n.isLeaf:
+    codes[n.sym] = code
+  else:
+    buildCodes(n.children[0], code & false, codes)
+    buildCodes(n.children[1], code & true, codes)
+
+proc layoutTree(root: HuffNode): string =
+  ## 
+  ## Serialise a Huffman tree into the BIOS tree table format.
+  ## 
+  ## Nodes are stored in pairs, and each internal node has a 6-bit offset to the
+  ## pair holding its children. So a pair must be placed no more than 64 pairs
+  ## after its parent. Plain breadth-first order breaks this for large trees,
+  ## so instead we place small subtrees first whenever doing so can't cause any
+  ## other pending pair to miss its deadline.
+  ## 
+  ## Returns an empty string if no valid layout was found.
+  ## 
+  type Pending = tuple[address: int; node: HuffNode; deadline: int]
+  
+  result = newString(2)   # size byte, root node
+  var pending = @[(address: 1, node: root, deadline: 64).Pending]
+  var pair = 1
+  
+  proc feasible(j: int): bool =
+    # Can every other pending pair still be placed in time if we take `j` now?
+    var deadlines: seq[int]
+    for k, p in pending:
+      if k != j: deadlines.add p.deadline
+    for c in pending[j].node.children:
+      if not c.isLeaf: deadlines.add pair + 64
+    deadlines.sort()
+    for k, d in deadlines:
+      if d < pair + 1 + k: return false
+    true
+  
+  while pending.len > 0:
+    var order = newSeq[int](pending.len)
+    for j in 0..<pending.len: order[j] = j
+    order.sort do (a, b: int) -> int:
+      result = cmp(pending[a].node.internalCount, pending[b].node.internalCount)
+      if result == 0: result = cmp(pending[a].deadline, pending[b].deadline)
+    
+    var choice = -1
+    for j in order:
+      if pending[j].deadline >= pair and feasible(j):
+        choice = j
+        break
+    if choice == -1:
+      return ""
+    
+    let (address, node, _) = pending[choice]
+    pending.delete(choice)
+    
+    let offset = pair - (address div 2) - 1
+    assert(offset in 0..63)
+    result[address] = chr(ord(result[address]) or offset)
+    result.add "\0\0"
+    
+    for k, c in node.children:
+      let a = pair*2 + k
+      if c.isLeaf:
+        result[address] = chr(ord(result[address]) or (0x80 shr k))
+        result[a] = chr(c.sym)
+      else:
+        pending.add (address: a, node: c, deadline: pair + 64)
+    
+    inc pair
+
+proc huffCompress*(data: string; bits: range[4..8] = 8): string =
+  ## 
+  ## Compress data in the format used by `HuffUnComp`.
+  ## 
+  ## :bits: Size of each symbol, either 4 or 8.
+  ## 
+  ## Returns an empty string if the Huffman tree couldn't be encoded, which
+  ## can happen with 8-bit symbols. 4-bit symbols always succeed.
+  ## 
+  doAssert(bits in {4, 8}, "Huffman symbols must be 4 or 8 bits")
+  doAssert((data.len mod 4) == 0, "Huffman compressed data must be a multiple of 4 bytes")
+  
+  var syms: seq[int]
+  for c in data:
+    if bits == 8:
+      syms.add ord(c)
+    else:
+      syms.add ord(c) and 0xf
+      syms.add ord(c) shr 4
+  
+  var freqs = newSeq[int](1 shl bits)
+  for s in syms:
+    inc freqs[s]
+  
+  # Build the tree. Ties are broken by creation order, for deterministic output.
+  var nodes: seq[(HuffNode, int)]
+  var counter = 0
+  for s, f in freqs:
+    if f > 0:
+      nodes.add (HuffNode(freq: f, sym: s), counter)
+      inc counter
+  
+  if nodes.len == 0:
+    nodes.add (HuffNode(sym: 0), counter)
+    inc counter
+  if nodes.len == 1:
+    # The tree needs at least one branch, so add a dummy symbol.
+    let other = (nodes[0][0].sym + 1) mod (1 shl bits)
+    nodes.add (HuffNode(sym: other), counter)
+    inc counter
+  
+  proc byFreq(a, b: (HuffNode, int)): int =
+    result = cmp(a[0].freq, b[0].freq)
+    if result == 0: result = cmp(a[1], b[1])
+  
+  while nodes.len > 1:
+    nodes.sort(byFreq)
+    let (a, _) = nodes[0]
+    let (b, _) = nodes[1]
+    nodes.delete(0)
+    nodes.delete(0)
+    nodes.add (HuffNode(
+      freq: a.freq + b.freq,
+      children: [a, b],
+      internalCount: 1 + a.internalCount + b.internalCount,
+    ), counter)
+    inc counter
+  
+  let root = nodes[0][0]
+  
+  var table = layoutTree(root)
+  if table.len == 0:
+    return ""
+  table.padToWord()
+  table[0] = chr(table.len div 2 - 1)
+  
+  var codes = newSeq[seq[bool]](1 shl bits)
+  buildCodes(root, @[], codes)
+  
+  result.addHeader(huffHeaderTag or bits, data.len)
+  result.add table
+  
+  # Bitstream is stored in 32-bit units, most significant bit first.
+  var word, numBits: uint32
+  
+  proc flushWord(s: var string; word: uint32) =
+    for k in 0..3:
+      s.add char((word shr (k*8)) and 0xff)
+  
+  for s in syms:
+    for bit in codes[s]:
+      word = (word shl 1) or bit.uint32
+      inc numBits
+      if numBits == 32:
+        result.flushWord(word)
+        word = 0
+        numBits = 0
+  
+  if numBits > 0:
+    result.flushWord(word shl (32 - numBits))
+
+
+# Diff filter
+# -----------
+
+proc diffFilter*(data: string; unitSize: range[1..2]): string =
+  ## 
+  ## Replace each 8-bit or 16-bit unit with its difference from the previous one.
+  ## 
+  ## This doesn't shrink the data by itself, but it can make smooth gradients or
+  ## incrementing tile IDs much more compressible.
+  ## 
+  ## The output has no header, unlike the format used by `Diff8bitUnFilterWram`
+  ## etc. because Natu undoes the filter in place after decompressing.
+  ## 
+  result = newString(data.len)
+  if unitSize == 1:
+    var last = 0'u8
+    for i, c in data:
+      result[i] = char(c.uint8 - last)
+      last = c.uint8
+  else:
+    doAssert((data.len mod 2) == 0, "16-bit diff filtered data must be a multiple of 2 bytes")
+    var last = 0'u16
+    for i in countup(0, data.len-1, 2):
+      let v = data[i].uint16 or (data[i+1].uint16 shl 8)
+      let d = v - last
+      result[i] = char(d and 0xff)
+      result[i+1] = char(d shr 8)
+      last = v
+
+
+proc compress*(data: string; kind: CompressionKind): string =
+  ## 
+  ## Compress some data using the given method.
+  ## 
+  ## For `Huff`, both 8-bit and 4-bit symbols are tried and the smaller result is kept.
+  ## The data must be a multiple of 4 bytes, so pass `kind` through `usableKind` first.
+  ## 
+  case kind
+  of None: data
+  of Lz77: lz77Compress(data)
+  of Rle: rleCompress(data)
+  of Huff:
+    let h4 = huffCompress(data, 4)
+    let h8 = huffCompress(data, 8)
+    if h8.len > 0 and h8.len < h4.len: h8 else: h4
+
+func usableKind*(kind: CompressionKind; len: int): CompressionKind =
+  ## The compression kind to actually use for `len` bytes of data.
+  ## 
+  ## The BIOS Huffman decoder always writes whole words, so it would spill past the
+  ## end of data that isn't a multiple of 4 bytes. Such data falls back to LZ77.
+  if kind == Huff and (len mod 4) != 0: Lz77
+  else: kind
+
+proc ratioInfo*(what: string; kind: CompressionKind; before, after: int): string =
+  ## Describe how well some data was compressed, for the converter's output.
+  let pct = if before > 0: after * 100 / before else: 100.0
+  result = "  " & what & ": " & $before & " -> " & $after & " bytes (" & $kind & ", " & formatFloat(pct, ffDecimal, 1) & "%)\n"
+  if after >= before:
+    result.add "  Warning, " & what & " got bigger.\n"
@@ -1,7 +1,7 @@
 import strutils, strscans, strformat, parseopt
-import options, os, times
+import options, os, streams, tables
 import trick
-import ./common
+import ./common, ./compression
 
 when (NimMajor, NimMinor) >= (1, 6):
   {.push warning[HoleEnumConv]:off.}   # https://github.com/nim-lang/Nim/issues/19238
@@ -15,6 +15,8 @@ type
   GraphicFlag* = enum
     StrictPal
     PalOnly
+    Dedupe
+    DedupeFlips
   
   GraphicRow = object
     ## Just the stuff parsed from the tsv
@@ -24,6 +26,7 @@ type
     bpp: GfxBpp
     palNum: int
     flags: set[GraphicFlag]
+    comp: CompressionKind
   
   GraphicData = object
     ## Data to be output as Nim code
@@ -38,25 +41,208 @@ type
     palHalfwords: int
     frames: int
     frameWords: int
+    comp: CompressionKind
+    framePos: int  ## Index of the first frame in the frame offsets table (compressed graphics only)
 
 
-proc writeGraphicsC(f: File; imgData, palData: string) =
+proc writeGraphicsC(f: File; imgData, palData: string; frameOffsets: seq[int]) =
   include "templates/graphics.c.template"
 
-proc writeGraphicsNim(f: File; gfxRows: seq[GraphicRow]; gfxDatas: seq[GraphicData]; numPalettes, palDataLen, imgDataLen: int) =
+proc writeGraphicsNim(f: File; gfxRows: seq[GraphicRow]; gfxDatas: seq[GraphicData]; numPalettes, palDataLen, imgDataLen, frameOffsetsLen: int) =
   include "templates/graphics.nim.template"
 
 
+type
+  GraphicResult = object
+    ## Converted image data for a single graphic.
+    img: string
+    frameOffsets: seq[int]  ## Position of each frame within `img` (compressed graphics only)
+    imgWords: int           ## Uncompressed size
+    frames: int
+    frameWords: int
+  
+  PalGroupResult = object
+    ## Output of converting a group of graphics which share a palette.
+    pal: seq[Color]
+    graphics: seq[GraphicResult]
+    log: string
+
+const cacheVersion = "1"  # bump this if the format of the cache files changes.
+
+proc convertPalGroup(rows: seq[GraphicRow]): PalGroupResult {.gcsafe.} =
+  ## Convert a group of graphics on a worker thread. Like `convertBg`, it works
+  ## only with its arguments and return value, and just the call into trick's
+  ## PNG loader is cast to GC-safe.
+  var
+    currentPal = @[clrEmpty]
+    namesInCurrentPal: seq[string]  # all gfx names with a shared pal are added here (only for troubleshooting really)
+  let bpp = ord(rows[0].bpp)
+  
+  for g in rows:
+    result.log.add g.pngPath & "\n"
+    
+    doAssert(
+      ord(g.bpp) == bpp,
+      "Graphics that share a palette must have the same bpp ({g.name} is {ord(g.bpp)} but the first graphic was {bpp}).".fmt
+    )
+    
+    # convert the graphic
+    var info = GfxInfo(
+      pal: currentPal,
+      bpp: g.bpp,
+      layout: gfxTiles,
+    )
+    var data: string
+    {.cast(gcsafe).}:
+      data = pngToBin(g.pngPath, info, if StrictPal in g.flags: StrictGrowth else: LaxGrowth)
+    doAssert(info.width == g.w, "PNG width ({info.width}) should match the graphic width ({g.w}). Spritesheets must be provided as a vertical strip.".fmt)
+    
+    if PalOnly in g.flags: data = ""
+    
+    # Won't work yet because trick doesn't set the height?
+    # doAssert((info.height mod g.h) == 0, "PNG height should be a multiple of the graphic height. Spritesheets must be provided as a vertical strip.")
+    
+    let pixelsPerByte = 8 div ord(g.bpp)
+    let frameLen = (g.w * g.h) div pixelsPerByte
+    currentPal = info.pal
+    namesInCurrentPal.add(g.pngPath.extractFilename())
+    
+    var res = GraphicResult(
+      imgWords: data.len div 4,
+      frames: data.len div frameLen,
+      frameWords: frameLen div 4,
+    )
+    
+    if g.comp == None:
+      res.img = data
+    else:
+      # Frames are compressed individually so they can still be copied one at a time.
+      for i in 0..<res.frames:
+        res.frameOffsets.add(res.img.len)
+        res.img.add(compress(data[i*frameLen ..< (i+1)*frameLen], g.comp))
+        while (res.img.len mod 4) != 0:
+          res.img.add('\0')
+      result.log.add ratioInfo(g.name, g.comp, data.len, res.img.len)
+    
+    result.graphics.add(res)
+  
+  let maxColors = (1 shl bpp)
+  doAssert(
+    currentPal.len <= maxColors,
+    "Palette has {currentPal.len} colors, max is {maxColors}. Used by: {namesInCurrentPal}\nPalette = {currentPal}".fmt
+  )
+  result.pal = currentPal
+
+
+# Frame deduplication
+# -------------------
+# Flipped frames are marked in the top bits of their entry in the frame offsets table.
+
+const
+  frameHFlip = 1 shl 30
+  frameVFlip = 1 shl 31
+
+proc frameAt(res: GraphicResult; comp: CompressionKind; f: int): string =
+  ## The data for a single frame of a converted graphic.
+  if comp == None:
+    res.img[f*res.frameWords*4 ..< (f+1)*res.frameWords*4]
+  else:
+    let stop = if f+1 < res.frames: res.frameOffsets[f+1] else: res.img.len
+    res.img[res.frameOffsets[f] ..< stop]
+
+proc flipFrame*(frame: string; w, h, bpp: int; hflip, vflip: bool): string =
+  ## Flip a frame made of 4bpp or 8bpp tiles in row-major order.
+  ## At runtime, `copyFrameFlipped` in `natu/private/frameflip` undoes this.
+  result = newString(frame.len)
+  let tw = w div 8
+  let th = h div 8
+  let rowBytes = bpp  # 8 pixels per row
+  let tileBytes = rowBytes * 8
+  for ty in 0..<th:
+    for tx in 0..<tw:
+      let sx = if hflip: tw-1-tx else: tx
+      let sy = if vflip: th-1-ty else: ty
+      let dt = (ty*tw + tx) * tileBytes
+      let st = (sy*tw + sx) * tileBytes
+      for row in 0..<8:
+        let srow = if vflip: 7-row else: row
+        for b in 0..<rowBytes:
+          let d = dt + row*rowBytes + b
+          if hflip:
+            let c = frame[st + srow*rowBytes + (rowBytes-1-b)]
+            result[d] = if bpp == 4: chr(((ord(c) and 0xf) shl 4) or (ord(c) shr 4)) else: c
+          else:
+            result[d] = frame[st + srow*rowBytes + b]
+
+proc findDuplicate*(frameLookup: Table[string, int]; frame: string; comp: CompressionKind; w, h, bpp: int; canFlip: bool): int =
+  ## Look for a frame that's already in the image data, as-is or (if `canFlip`) flipped.
+  ## 
+  ## Returns its entry for the frame offsets table, with `frameHFlip`/`frameVFlip` set
+  ## if the stored frame must be flipped to get this one, or `-1` if there's no match.
+  let prefix = $comp & ":"
+  result = frameLookup.getOrDefault(prefix & frame, -1)
+  if result == -1 and canFlip:
+    for (hflip, vflip) in [(true, false), (false, true), (true, true)]:
+      let pos = frameLookup.getOrDefault(prefix & flipFrame(frame, w, h, bpp, hflip, vflip), -1)
+      if pos != -1:
+        return pos or (if hflip: frameHFlip else: 0) or (if vflip: frameVFlip else: 0)
+
+
+# Cache files
+# -----------
+# Each palette group is cached in a file named after the hash of its inputs.
+
+proc writeBlob(s: Stream; data: string) =
+  s.write(data.len.int32)
+  s.write(data)
+
+proc readBlob(s: Stream): string =
+  s.readStr(s.readInt32().int)
+
+proc writeCache(path: string; r: PalGroupResult) =
+  var s = newFileStream(path, fmWrite)
+  defer: s.close()
+  s.writeBlob(r.pal.toBytes())
+  s.write(r.graphics.len.int32)
+  for g in r.graphics:
+    s.writeBlob(g.img)
+    s.write(g.imgWords.int32)
+    s.write(g.frames.int32)
+    s.write(g.frameWords.int32)
+    s.write(g.frameOffsets.len.int32)
+    for n in g.frameOffsets:
+      s.write(n.int32)
+
+proc readCache(path: string): PalGroupResult =
+  var s = newFileStream(path, fmRead)
+  defer: s.close()
+  let palBytes = s.readBlob()
+  for i in countup(0, palBytes.len-1, 2):
+    result.pal.add Color(palBytes[i].uint16 or (palBytes[i+1].uint16 shl 8))
+  for i in 0..<s.readInt32():
+    var g: GraphicResult
+    g.img = s.readBlob()
+    g.imgWords = s.readInt32().int
+    g.frames = s.readInt32().int
+    g.frameWords = s.readInt32().int
+    for j in 0..<s.readInt32():
+      g.frameOffsets.add s.readInt32().int
+    result.graphics.add(g)
+
+
 proc gfxConvert*(tsvPath, script, indir, outdir: string) =
   var gfxRows: seq[GraphicRow]
+  var groups: seq[seq[GraphicRow]]  # consecutive graphics that share a palette
+  var groupTsv: seq[string]         # the .tsv rows for each group, used as part of its hash
   
   let outputCPath = outdir / "graphics.c"
   let outputNimPath = outdir / "graphics.nim"
+  let outputHashPath = outdir / "graphics.hash"
+  let cacheDir = outdir / "graphics"
   
-  var newestModifiedIn = getLastModificationTime(script)
-  var oldestModifiedOut = oldest(outputCPath, outputNimPath)
+  createDir(cacheDir)
   
-  # parse graphics from .tsv and check their modification dates
+  # parse graphics from .tsv
   
   for row in tsvRows(tsvPath):
     
@@ -65,13 +251,12 @@ proc gfxConvert*(tsvPath, script, indir, outdir: string) =
     
     let pngPath = indir / dir / name & ".png"
     doAssert(fileExists(pngPath), "No such file " & pngPath)
-    newestModifiedIn = newest(newestModifiedIn, pngPath, pngPath.parentDir)
     
     var w, h: int
     let scanned = scanf(row[1], "s$ix$i", w, h)
     doAssert scanned
     
-    gfxRows.add GraphicRow(
+    let g = GraphicRow(
       pngPath: pngPath,
       name: "gfx" & name.toCamelCase(firstUpper=true),
       w: w,
@@ -79,101 +264,132 @@ proc gfxConvert*(tsvPath, script, indir, outdir: string) =
       bpp: parseEnum[GfxBpp](fmt"gfx{row[2]}bpp"),
       palNum: parseInt(row[3]),
       flags: cast[set[GraphicFlag]](parseUInt(row[4])),
+      comp: parseEnum[CompressionKind](row[5]),
     )
+    gfxRows.add g
+    
+    if groups.len == 0 or groups[^1][0].palNum != g.palNum:
+      groups.add @[g]
+      groupTsv.add ""
+    else:
+      groups[^1].add g
+    groupTsv[^1].add row.join("\t") & "\n"
   
-  # regenerate the output files if any input files have changed:
+  # hash each palette group, and convert the ones that aren't in the cache on worker threads.
   
-  if newestModifiedIn > oldestModifiedOut:
-    
+  var groupHashes: seq[string]
+  var results = newSeq[PalGroupResult](groups.len)
+  var pending: seq[int]
+  var pendingGroups: seq[seq[GraphicRow]]
+  
+  for i, group in groups:
+    var pngPaths: seq[string]
+    for g in group: pngPaths.add g.pngPath
+    let h = contentHash(pngPaths, cacheVersion & "\n" & groupTsv[i])
+    groupHashes.add h
+    let cachePath = cacheDir / h & ".bin"
+    if fileExists(cachePath):
+      results[i] = readCache(cachePath)
+    else:
+      pending.add i
+      pendingGroups.add group
+  
+  if pending.len > 0:
     echo "Converting graphics:"
+  
+  let converted = parallelMap(pendingGroups, convertPalGroup)
+  for j, i in pending:
+    results[i] = converted[j]
+    stdout.write results[i].log
+    writeCache(cacheDir / groupHashes[i] & ".bin", results[i])
+  
+  # remove stale cache files
+  
+  for path in walkFiles(cacheDir / "*.bin"):
+    if path.splitFile.name notin groupHashes:
+      removeFile(path)
+  
+  # regenerate the output files if anything has changed:
+  
+  let allHash = stableHash(groupHashes)
+  
+  if pending.len > 0 or
+      not fileExists(outputCPath) or
+      not fileExists(outputNimPath) or
+      not fileExists(outputHashPath) or
+      readFile(outputHashPath) != allHash:
+    
+    # assemble the data in the original order, so the output is deterministic.
     var
       palData = ""  # binary data of all sprite palettes in the game
       imgData = ""  # binary data of all sprite images in the game
+      frameOffsets: seq[int]  # position of each frame in imgData, for compressed or deduped graphics
       gfxDatas: seq[GraphicData]
-      currentPal = @[clrEmpty]
-      namesInCurrentPal: seq[string]  # all gfx names with a shared pal are added here (only for troubleshooting really)
-      lastPalGroup = 0
-      lastBpp = -1
-    
-    # to append and reset the current palette
-    proc flushSharedPalette =
-      let maxColors = (1 shl lastBpp)
-      doAssert(
-        currentPal.len <= maxColors,
-        "Palette has {currentPal.len} colors, max is {maxColors}. Used by: {namesInCurrentPal}\nPalette = {currentPal}".fmt
-      )
-      let palBytes = currentPal.toBytes()
-      palData.add(palBytes)
-      var i = gfxDatas.len-1
-      while i >= 0 and gfxDatas[i].palNum == lastPalGroup:
-        gfxDatas[i].palHalfwords = currentPal.len
-        dec i
-      currentPal = @[clrEmpty]
-      namesInCurrentPal = @[]
-    
-    for g in gfxRows:
-      echo g.pngPath
-      
-      if lastBpp == -1:
-        lastBpp = ord(g.bpp)
+      frameLookup: Table[string, int]  # frame data (prefixed by compression kind) -> position in imgData
+    
+    for i, group in groups:
+      let r = results[i]
+      let palPos = palData.len
+      palData.add r.pal.toBytes()
       
-      if g.palNum == lastPalGroup:
-        # this graphic shares a palette with the previous
-        doAssert(
-          ord(g.bpp) == lastBpp,
-          "Graphics that share a palette must have the same bpp ({g.name} is {ord(g.bpp)} but the previous graphic was {lastBpp})."
+      for j, g in group:
+        let res = r.graphics[j]
+        gfxDatas.add GraphicData(
+          bpp: ord(g.bpp),
+          size: parseEnum[ObjSize]("s" & $g.w & "x" & $g.h),
+          flags: g.flags,
+          w: g.w,
+          h: g.h,
+          imgPos: imgData.len,
+          imgWords: res.imgWords,
+          palNum: g.palNum,
+          palPos: palPos,
+          palHalfwords: r.pal.len,
+          frames: res.frames,
+          frameWords: res.frameWords,
+          comp: g.comp,
+          framePos: frameOffsets.len,
         )
-      else:
-        # this graphic has a new palette
-        flushSharedPalette()
-        lastPalGroup = g.palNum
-      
-      lastBpp = ord(g.bpp)
-      
-      # convert the graphic
-      var info = GfxInfo(
-        pal: currentPal,
-        bpp: g.bpp,
-        layout: gfxTiles,
-      )
-      var data = pngToBin(g.pngPath, info, if StrictPal in g.flags: StrictGrowth else: LaxGrowth)
-      doAssert(info.width == g.w, "PNG width ({info.width}) should match the graphic width ({g.w}). Spritesheets must be provided as a vertical strip.".fmt)
-      
-      if PalOnly in g.flags: data = ""
-      
-      # Won't work yet because trick doesn't set the height?
-      # doAssert((info.height mod g.h) == 0, "PNG height should be a multiple of the graphic height. Spritesheets must be provided as a vertical strip.")
-      
-      let pixelsPerByte = 8 div ord(g.bpp)
-      let frameLen = (g.w * g.h) div pixelsPerByte
-      let size = parseEnum[ObjSize]("s" & $g.w & "x" & $g.h)
-      currentPal = info.pal
-      namesInCurrentPal.add(g.pngPath.extractFilename())
-      
-      # push data necessary for codegen
-      gfxDatas.add GraphicData(
-        bpp: ord(g.bpp),
-        size: size,
-        flags: g.flags,
-        w: g.w,
-        h: g.h,
-        imgPos: imgData.len,
-        imgWords: data.len div 4,
-        palNum: lastPalGroup,
-        palPos: palData.len,
-        palHalfwords: -1,  # calculated retroactively by flushSharedPalette
-        frames: data.len div frameLen,
-        frameWords: frameLen div 4,
-      )
-      imgData.add(data)
-    
-    flushSharedPalette()
+        
+        if Dedupe in g.flags:
+          let canFlip = DedupeFlips in g.flags and g.comp == None and ord(g.bpp) in {4, 8}
+          var dupes, saved = 0
+          for f in 0..<res.frames:
+            let frame = frameAt(res, g.comp, f)
+            let prefix = $g.comp & ":"
+            let found = findDuplicate(frameLookup, frame, g.comp, g.w, g.h, ord(g.bpp), canFlip)
+            if found != -1:
+              frameOffsets.add(found)
+              inc dupes
+              saved += frame.len
+            else:
+              frameLookup[prefix & frame] = imgData.len
+              frameOffsets.add(imgData.len)
+              imgData.add(frame)
+          # only shown when the output is regenerated, not when it's all cached.
+          if dupes > 0:
+            echo "  ", g.name, ": ", dupes, " of ", res.frames, " frames deduplicated, saved ", saved, " bytes"
+        else:
+          for f in 0..<res.frames:
+            let pos = imgData.len + (if g.comp == None: f*res.frameWords*4 else: res.frameOffsets[f])
+            discard frameLookup.hasKeyOrPut($g.comp & ":" & frameAt(res, g.comp, f), pos)
+          for n in res.frameOffsets:
+            frameOffsets.add(imgData.len + n)
+          imgData.add(res.img)
+    
+    # `GraphicData.framePos` is a uint16 at runtime.
+    doAssert(frameOffsets.len <= high(uint16).int,
+      "Too many compressed or deduplicated frames ({frameOffsets.len}), the limit is {high(uint16)}.".fmt)
+    
+    let numPalettes = if groups.len > 0: groups[^1][0].palNum + 1 else: 1
     
     withFile(outputNimPath, fmWrite):
-      file.writeGraphicsNim(gfxRows, gfxDatas, lastPalGroup + 1, palData.len, imgData.len)
+      file.writeGraphicsNim(gfxRows, gfxDatas, numPalettes, palData.len, imgData.len, frameOffsets.len)
     
     withFile(outputCPath, fmWrite):
-      file.writeGraphicsC(imgData, palData)
+      file.writeGraphicsC(imgData, palData, frameOffsets)
+    
+    writeFile(outputHashPath, allHash)
   
   else:
     echo "Skipping graphics."
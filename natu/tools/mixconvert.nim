@@ -1,37 +1,199 @@
 # parallel to `mmconvert.nim` but for the SDL-based mixer
-import std/[strutils, strformat, parseopt, options, os, osproc, times, streams]
+import std/[strutils, strformat, parseopt, options, os, times]
 import trick, riff
 import ./common
+import ../private/sdl/samples
 
 type
   LoopKind* = enum
     LoopNone
     LoopForward
     LoopPingPong
+  SampleEncoding* = enum
+    SampleInt16
+    SampleAdpcm
   SampleInfo* = object
-    dataStart: uint32   # measured in floats
+    dataStart: uint32   # measured in floats, if the whole bank were decoded
     dataEnd: uint32     # .. (exclusive)
     channels: uint16
     sampleRate: uint32
     loopKind: LoopKind
     loopStart: uint32  # measured in samples (mono or stereo)
     loopEnd: uint32    # ..
+    length: uint32      # measured in samples (mono or stereo)
+    encoding: SampleEncoding
+    byteStart: uint32   # measured in bytes
+    byteEnd: uint32     # .. (exclusive)
 
-proc writeSdlSoundbankNim(f: File; modFilePaths, sfxList, modList: seq[string]; sfxInfo: seq[SampleInfo]; sampleDataLen: int) =
+const soundbankMagic = "NSB1"
+
+proc writeSdlSoundbankNim(f: File; modFilePaths, sfxList, modList: seq[string]; sfxInfo: seq[SampleInfo]; soundbankName, devPath: string) =
   include "templates/sdl_soundbank.nim.template"
 
-proc writeSdlSoundbankC(f: File; data: string) =
-  include "templates/sdl_soundbank.c.template"
 
-proc mixConvert*(script, sfxdir, moddir, outdir: string, files: seq[string]) =
+type
+  SampleJob = tuple
+    ## The input for converting a single .wav file on a worker thread.
+    path: string
+    encoding: SampleEncoding
+  
+  SampleResult = object
+    ## The output of converting a single .wav file on a worker thread.
+    info: SampleInfo
+    data: string
+  
+  WavFile = object
+    ## The parts of a .wav file that the converter cares about.
+    loopType: uint32
+    loopStart: uint32
+    loopEnd: uint32
+    compressionCode: uint16
+    channels: uint16
+    sampleRate: uint32
+    bitDepth: uint16
+    data: seq[uint8]
+
+proc readWav(path: string): WavFile =
+  
+  let f = path
+  
+  # var rootChunk, fmtChunk, dataChunk, smplChunk: ChunkInfo
+  var rr = openRiffFile(f)
+  var isWaveFile = false
+  var wav: WavFile
+  
+  proc check(chunk: ChunkInfo) =
+    case chunk.id
+    of "RIFF":
+      doAssert(chunk.formatTypeId == "WAVE", &"got {rr.currentChunk.formatTypeId} for {f}")
+      isWaveFile = true
+    of "fmt ":
+      wav.compressionCode = rr.read(uint16)  # compression code
+      doAssert(
+        wav.compressionCode == 1 or           # PCM (general)
+        wav.compressionCode == 3,             # IEEE float
+        &"got {wav.compressionCode} for {f}"
+      )
+      wav.channels = rr.read(uint16)     # number of channels
+      wav.sampleRate = rr.read(uint32)   # sample rate (Hz)
+      discard rr.read(uint32)            # average bytes per second
+      discard rr.read(uint16)            # block align (size of a sample on 1 channel * num channels)
+      wav.bitDepth = rr.read(uint16)     # bits per sample
+    
+    of "smpl":
+      discard rr.read(uint32)  # manufacturer
+      discard rr.read(uint32)  # product
+      discard rr.read(uint32)  # sample period
+      discard rr.read(uint32)  # midi unity note
+      discard rr.read(uint32)  # midi pitch fraction
+      discard rr.read(uint32)  # smpte format
+      discard rr.read(uint32)  # smpte offset
+      let numSampleLoops = rr.read(uint32)
+      discard rr.read(uint32)  # sample data
+      if numSampleLoops > 0:
+        doAssert(numSampleLoops == 1, &"{f} contains multiple loop points, which is unsupported.")
+        discard rr.read(uint32)             # cue point ID
+        wav.loopType = rr.read(uint32) + 1  # 0 = none, 1 = forward, 2 = bidirectional
+        wav.loopStart = rr.read(uint32)     # loop start
+        wav.loopEnd = rr.read(uint32)       # loop end
+        discard rr.read(uint32)             # fraction
+        discard rr.read(uint32)             # play count
+    
+    of "data":
+      let size = chunk.size
+      wav.data = newSeq[uint8](size)
+      if size > 0:
+        rr.read(wav.data, 0, size.int)
+  
+  # parse the RIFF chunks:
+  try:
+    doAssert(rr.currentChunk.id == "RIFF", &"got {rr.currentChunk.id} for {f}")
+    check(rr.currentChunk)
+    # the root RIFF chunk is a group chunk so it must be entered
+    if rr.hasSubChunks():
+      check(rr.enterGroup())
+      # iterate through all top-level chunks inside the root RIFF group chunk
+      while rr.hasNextChunk():
+        check(rr.nextChunk())
+  finally:
+    rr.close()
+  
+  wav
+
+proc convertSample(job: SampleJob): SampleResult {.gcsafe.} =
+  ## Runs on a worker thread. Only the .wav parsing is cast to GC-safe, as
+  ## the riff library isn't annotated, but it only touches the file it opens.
+  
+  let f = job.path
+  let encoding = job.encoding
+  var wav: WavFile
+  {.cast(gcsafe).}:
+    wav = readWav(f)
+  
+  let channels = wav.channels
+  let data = wav.data
+  
+  doAssert(channels in 1'u16..2'u16, &"{f} has {channels} channels, only mono and stereo are supported.")
+  
+  # convert to 16-bit signed
+  var pcm: seq[int16]
+  
+  case wav.bitDepth
+  of 8:
+    # 8-bit unsigned
+    pcm = newSeq[int16](data.len)
+    for i, b in data:
+      pcm[i] = int16((b.int - 128) shl 8)
+  of 16:
+    # 16-bit signed
+    pcm = newSeq[int16](data.len div 2)
+    for i in 0..<pcm.len:
+      pcm[i] = cast[int16](data[i*2].uint16 or (data[i*2+1].uint16 shl 8))
+  of 32:
+    # 32-bit float
+    doAssert(wav.compressionCode == 3, &"{f} has unsupported 32-bit integer samples")
+    pcm = newSeq[int16](data.len div 4)
+    for i in 0..<pcm.len:
+      let bits = data[i*4].uint32 or (data[i*4+1].uint32 shl 8) or
+                 (data[i*4+2].uint32 shl 16) or (data[i*4+3].uint32 shl 24)
+      pcm[i] = int16(clamp(cast[float32](bits) * 32768f, -32768f, 32767f))
+  else:
+    raiseAssert(&"{f} has unsupported bit depth '{wav.bitDepth}'")
+  
+  pcm.setLen(pcm.len - (pcm.len mod channels.int))
+  
+  result.info = SampleInfo(
+    loopKind: wav.loopType.LoopKind,
+    loopStart: wav.loopStart,
+    loopEnd: wav.loopEnd,
+    length: (pcm.len div channels.int).uint32,
+    channels: channels,
+    encoding: encoding,
+    sampleRate: wav.sampleRate,
+  )
+  
+  case encoding
+  of SampleInt16:
+    result.data = newString(pcm.len * 2)
+    for i, v in pcm:
+      result.data[i*2] = char(cast[uint16](v) and 0xff)
+      result.data[i*2+1] = char(cast[uint16](v) shr 8)
+  of SampleAdpcm:
+    result.data = adpcmEncode(pcm, channels.int)
+
+proc mixConvert*(script, sfxdir, moddir, outdir: string, files: seq[string]; adpcmFiles: seq[string] = @[]; bindir = "") =
   var sfxFilePaths, modFilePaths, sfxList, modList: seq[string]
+  var sfxEncodings: seq[SampleEncoding]
   var sfxInfo: seq[SampleInfo]
   
+  const soundbankName = "sdl_soundbank.bin"
   let outputNimPath = outdir / "sdl_soundbank.nim"
-  let outputCPath = outdir / "sdl_soundbank.c"
+  let outputBinPath = outdir / soundbankName
   
   var newestModifiedIn = getLastModificationTime(script)
-  var oldestModifiedOut = oldest(outputNimPath, outputCPath)
+  var oldestModifiedOut = oldest(outputNimPath, outputBinPath)
+  if bindir != "":
+    oldestModifiedOut = oldest(oldestModifiedOut, bindir / soundbankName)
   
   # collate and check modification dates of input files
   
@@ -47,6 +209,7 @@ proc mixConvert*(script, sfxdir, moddir, outdir: string, files: seq[string]) =
       inPath = sfxdir / f
       sfxList.add toCamelCase("sfx_" & name)
       sfxFilePaths.add inPath
+      sfxEncodings.add(if f in adpcmFiles: SampleAdpcm else: SampleInt16)
     elif ext in modExts:
       inPath = moddir / f
       modList.add toCamelCase("mod_" & name)
@@ -64,153 +227,68 @@ proc mixConvert*(script, sfxdir, moddir, outdir: string, files: seq[string]) =
     
     echo "Building sdl soundbank:"
     
-    var outStream = newStringStream()
-    
-    for f in sfxFilePaths:
-      
-      let f = f
+    var jobs: seq[SampleJob]
+    for i, f in sfxFilePaths:
       echo f
-      
-      # var rootChunk, fmtChunk, dataChunk, smplChunk: ChunkInfo
-      var rr = openRiffFile(f)
-      var isWaveFile = false
-      
-      # sampler chunk
-      var loopType: uint32
-      var loopStart: uint32
-      var loopEnd: uint32
-      
-      # format chunk
-      var compressionCode: uint16
-      var channels: uint16
-      var blockAlign: uint32
-      var sampleRate: uint32
-      var bitDepth: uint16
-      
-      # data chunk
-      var size: uint32
-      var data: string
-      
-      proc check(chunk: ChunkInfo) =
-        case chunk.id
-        of "RIFF":
-          doAssert(chunk.formatTypeId == "WAVE", &"got {rr.currentChunk.formatTypeId} for {f}")
-          isWaveFile = true
-        of "fmt ":
-          compressionCode = rr.read(uint16)  # compression code
-          doAssert(
-            compressionCode == 1 or               # PCM (general)
-            compressionCode == 3,                 # IEEE float
-            &"got {compressionCode} for {f}"
-          )
-          channels = rr.read(uint16)         # number of channels
-          sampleRate = rr.read(uint32)       # sample rate (Hz)
-          discard rr.read(uint32)            # average bytes per second
-          blockAlign = rr.read(uint16)       # block align (size of a sample on 1 channel * num channels)
-          bitDepth = rr.read(uint16)         # bits per sample
-          
-        of "smpl":
-          discard rr.read(uint32)  # manufacturer
-          discard rr.read(uint32)  # product
-          discard rr.read(uint32)  # sample period
-          discard rr.read(uint32)  # midi unity note
-          discard rr.read(uint32)  # midi pitch fraction
-          discard rr.read(uint32)  # smpte format
-          discard rr.read(uint32)  # smpte offset
-          let numSampleLoops = rr.read(uint32)
-          discard rr.read(uint32)  # sample data
-          if numSampleLoops > 0:
-            doAssert(numSampleLoops == 1, &"{f} contains multiple loop points, which is unsupported.")
-            discard rr.read(uint32)         # cue point ID
-            loopType = rr.read(uint32) + 1  # 0 = none, 1 = forward, 2 = bidirectional
-            loopStart = rr.read(uint32)     # loop start
-            loopEnd = rr.read(uint32)       # loop end
-            discard rr.read(uint32)         # fraction
-            discard rr.read(uint32)         # play count
-            
-        of "data":
-          size = chunk.size
-          # size = rr.read(uint32)    # data size in bytes
-          for i in 0..<size:
-            data.add(rr.read(char))
-      
-      # parse the RIFF chunks:
-      try:
-        doAssert(rr.currentChunk.id == "RIFF", &"got {rr.currentChunk.id} for {f}")
-        check(rr.currentChunk)
-        # the root RIFF chunk is a group chunk so it must be entered
-        if rr.hasSubChunks():
-          check(rr.enterGroup())
-          # iterate through all top-level chunks inside the root RIFF group chunk
-          while rr.hasNextChunk():
-            check(rr.nextChunk())
-      finally:
-        rr.close()
+      jobs.add (f, sfxEncodings[i])
     
-      var sample = SampleInfo(
-        loopKind: loopType.LoopKind,
-        loopStart: loopStart,
-        loopEnd: loopEnd,
-        channels: channels,
-        sampleRate: sampleRate,
-        dataStart: (outStream.data.len div sizeof(float32)).uint32
-      )
-      
-      var inStream = newStringStream(data)
-      
-      case bitDepth
-      of 8:
-        # 8-bit unsigned
-        for i in 0..<size:
-          let n = inStream.readUint8().int - 127
-          outStream.write(n.float32 / 128f)
-      of 16:
-        # 16-bit signed
-        let numShorts = size.int div sizeof(int16)
-        for i in 0..<numShorts:
-          let n = inStream.readInt16()
-          outStream.write(n.float32 / 32768f)
-      of 32:
-        # 32-bit float
-        let numFloats = size.int div sizeof(float32)
-        for i in 0..<numFloats:
-          outStream.write(inStream.readFloat32)
-      else:
-        raiseAssert(&"{f} has unsupported bit depth '{bitDepth}'")
-        
-      sample.dataEnd = (outStream.data.len div sizeof(float32)).uint32
-      
+    # samples are stored one after another, each aligned to 4 bytes.
+    # dataStart/dataEnd are where each sample would be if the whole bank
+    # were decoded to floats, for hosts that don't read the compact format.
+    var bank = soundbankMagic
+    var numFloats = 0'u32
+    
+    for res in parallelMap(jobs, convertSample):
+      var sample = res.info
+      while (bank.len mod 4) != 0:
+        bank.add '\0'
+      sample.byteStart = bank.len.uint32
+      bank.add res.data
+      sample.byteEnd = bank.len.uint32
+      sample.dataStart = numFloats
+      numFloats += sample.length * sample.channels.uint32
+      sample.dataEnd = numFloats
       sfxInfo.add sample
     
-    withFile(outputNimPath, fmWrite):
-      file.writeSdlSoundbankNim(modFilePaths, sfxList, modList, sfxInfo, outStream.data.len)
+    writeFile(outputBinPath, bank)
+    if bindir != "":
+      createDir(bindir)
+      copyFile(outputBinPath, bindir / soundbankName)
     
-    withFile(outputCPath, fmWrite):
-      file.writeSdlSoundbankC(outStream.data)
+    withFile(outputNimPath, fmWrite):
+      file.writeSdlSoundbankNim(modFilePaths, sfxList, modList, sfxInfo, soundbankName, relativePath(outputBinPath, getCurrentDir()))
   
   else:
     echo "Skipping audio."
-  
+
 
 # Command Line Interface
 # ----------------------
 
 proc mixConvert*(p: var OptParser, progName: static[string] = "mixconvert") =
-  
+
   const helpMsg = """
 
 Usage:
-  """ & progName & """ --script:FILE --sfxdir:DIR --moddir:DIR --outdir:DIR <input files>
+  """ & progName & """ --script:FILE --sfxdir:DIR --moddir:DIR --outdir:DIR [--bindir:DIR] [--adpcm:FILE ...] <input files>
+
+Generates a soundbank for PC builds of the game.
+
+Samples are stored as 16-bit PCM, or as IMA-ADPCM if listed with --adpcm.
 
-Generates soundbank C and Nim files for PC builds of the game.
+The game looks for sdl_soundbank.bin next to the executable, so pass
+--bindir to copy it there. Failing that, it's loaded from the output
+directory, relative to the working directory at the time of the build.
 
 """
   var
     files: seq[string]
+    adpcmFiles: seq[string]
     script: string
     sfxdir: string
     moddir: string
     outdir: string
+    bindir: string
   
   while true:
     next(p)
@@ -223,6 +301,8 @@ Generates soundbank C and Nim files for PC builds of the game.
       of "sfxdir": sfxdir = p.val
       of "moddir": moddir = p.val
       of "outdir": outdir = p.val
+      of "bindir": bindir = p.val
+      of "adpcm": adpcmFiles.add p.val
       of "h","help": quit(helpMsg, 0)
       else: quit("Unrecognised option '" & p.key & "'\n" & helpMsg)
     of cmdEnd:
@@ -234,5 +314,5 @@ Generates soundbank C and Nim files for PC builds of the game.
   if moddir == "": quit("Please specify --moddir\n" & helpMsg, 0)
   if outdir == "": quit("Please specify --outdir\n" & helpMsg, 0)
   
-  mixConvert(script, sfxdir, moddir, outdir, files)
+  mixConvert(script, sfxdir, moddir, outdir, files, adpcmFiles, bindir)
 
@@ -1,6 +1,6 @@
-import std/[strutils, strformat, parseopt, options, os, osproc, times, streams]
+import std/[strutils, strformat, parseopt, options, os, times, streams]
 import trick, riff
-import ./common
+import ./common, ./msl
 
 proc writeSoundbankNim(f: File; sfxList, modList: seq[string]) =
   include "templates/soundbank.nim.template"
@@ -45,27 +45,10 @@ proc mmConvert*(script, sfxdir, moddir, outdir: string, files: seq[string]) =
     
     echo "Building soundbank:"
     
-    var mmutilPath = getAppDir() / "mmutil".addFileExt(ExeExt)
+    # load every file in parallel, then add them to the soundbank in order
+    let items = parallelMap(sfxFilePaths & modFilePaths, mslLoad)
     
-    if not fileExists(mmutilPath):
-      # Find mmutil in system path
-      mmutilPath = findExe("mmutil")
-      
-      # If none was found, try devkitPro tools directory as a fallback?
-      if mmutilPath == "" and existsEnv("DEVKITPRO"):
-        mmutilPath = getEnv("DEVKITPRO")/"tools"/"bin"/"mmutil".addFileExt(ExeExt)
-    
-    proc mmutil(args: string) =
-      doAssert(
-        fileExists(mmutilPath),
-        "Could not find mmutil executable! (mmutilPath = \"" & mmutilPath & "\")\n" &
-        "Ensure the directory containing the mmutil executable is in your PATH, or try reinstalling Natu."
-      )
-      let res = execCmd(mmutilPath & " " & args)
-      if res != 0:
-        raiseAssert("mmutil failed with code " & $res)
-    
-    mmutil "-o" & outputBinPath & " " & sfxFilePaths.join(" ") & " " & modFilePaths.join(" ")
+    mslBuild(outputBinPath, items)
     
     withFile(outputNimPath, fmWrite):
       file.writeSoundbankNim(sfxList, modList)
@@ -84,7 +67,7 @@ proc mmConvert*(p: var OptParser, progName: static[string] = "mmconvert") =
 Usage:
   """ & progName & """ --script:FILE --sfxdir:DIR --moddir:DIR --outdir:DIR <input files>
 
-Invokes the maxmod utility program to generate a soundbank, and produces Nim-friendly output.
+Generates a maxmod soundbank, and produces Nim-friendly output.
 
 """
   var
@@ -0,0 +1,44 @@
+## Bindings to the soundbank builder from mmutil, so that maxmod soundbanks
+## can be created in-process instead of by running the mmutil executable.
+
+{.compile:"../../vendor/mmutil/source/adpcm.c".}
+{.compile:"../../vendor/mmutil/source/files.c".}
+{.compile:"../../vendor/mmutil/source/it.c".}
+{.compile:"../../vendor/mmutil/source/mas.c".}
+{.compile:"../../vendor/mmutil/source/mod.c".}
+{.compile:"../../vendor/mmutil/source/msl.c".}
+{.compile:"../../vendor/mmutil/source/s3m.c".}
+{.compile:"../../vendor/mmutil/source/samplefix.c".}
+{.compile:"../../vendor/mmutil/source/simple.c".}
+{.compile:"../../vendor/mmutil/source/wav.c".}
+{.compile:"../../vendor/mmutil/source/xm.c".}
+{.passL:"-lm".}
+
+type
+  MslItem* {.incompleteStruct.} = object
+    ## A module or sample that has been loaded but not yet added to the soundbank.
+
+proc MSL_Begin(header: cstring) {.importc, cdecl.}
+proc MSL_Load(filename: cstring; verbose: bool): ptr MslItem {.importc, cdecl.}
+proc MSL_Add(item: ptr MslItem) {.importc, cdecl.}
+proc MSL_Export(filename: cstring): cint {.importc, cdecl.}
+proc MSL_End() {.importc, cdecl.}
+
+proc mslLoad*(path: string): ptr MslItem {.gcsafe.} =
+  ## Load and convert a .wav, .mod, .xm, .s3m or .it file.
+  ##
+  ## This is safe to call from several threads at once.
+  result = MSL_Load(path.cstring, false)
+  doAssert(result != nil, "Failed to load audio asset " & path)
+
+proc mslBuild*(outPath: string; items: openArray[ptr MslItem]) =
+  ## Create a soundbank from some loaded items, freeing them in the process.
+  ##
+  ## The sample and module IDs are given by the order of `items`,
+  ## with samples shared between modules stored only once.
+  MSL_Begin(nil)
+  for item in items:
+    MSL_Add(item)
+  let err = MSL_Export(outPath.cstring)
+  MSL_End()
+  doAssert(err == 0, "Could not write soundbank to " & outPath)
@@ -0,0 +1,157 @@
+## Summarise the output of `profileDump` from `natu/profiler`, as captured in
+## an mGBA log file or the stdout of the SDL backend.
+
+import std/[strformat, strutils, tables, parseopt, algorithm, sequtils, math, os]
+
+type
+  Options = object
+    filename: string
+    budget: int
+  
+  ZoneSample = object
+    cycles: int
+    calls: int
+  
+  FrameInfo = object
+    busy: int
+    elapsed: int
+    zones: Table[string, ZoneSample]
+
+const cyclesPerFrame = 280896
+
+proc parseLog(filename: string; zoneOrder: var seq[string]): Table[int, FrameInfo] =
+  # Lines may have a prefix such as "[WARN] GBA Debug: ", so look for the
+  # "prof" token anywhere in the line. Frames which appear more than once
+  # (because dumps overlapped) are only counted once.
+  var cur = -1
+  for line in lines(filename):
+    let pos = line.find("prof ")
+    if pos == -1: continue
+    let words = line[pos..^1].splitWhitespace()
+    if words.len == 5 and words[1] == "frame":
+      cur = parseInt(words[2])
+      result[cur] = FrameInfo(busy: parseInt(words[3]), elapsed: parseInt(words[4]))
+    elif words.len == 5 and words[1] == "zone" and cur != -1:
+      let name = words[2]
+      if name notin zoneOrder:
+        zoneOrder.add name
+      result[cur].zones[name] = ZoneSample(cycles: parseInt(words[3]), calls: parseInt(words[4]))
+
+proc pct(cycles: int): string =
+  formatFloat(100 * cycles / cyclesPerFrame, ffDecimal, 1) & "%"
+
+proc run(opts: Options) =
+  
+  var zoneOrder: seq[string]
+  let frames = parseLog(opts.filename, zoneOrder)
+  
+  if frames.len == 0:
+    quit("No profiler output found in " & opts.filename & "\n" &
+      "Make sure the game was built with -d:natuProfile and calls profileDump()", 1)
+  
+  var nums = toSeq(frames.keys)
+  nums.sort()
+  
+  echo &"{frames.len} frames ({nums[0]} .. {nums[^1]})"
+  echo ""
+  echo "Zone".alignLeft(16), "Frames".align(8), "Calls".align(8), "Min".align(10), "Avg".align(10), "Max".align(10), "Avg %".align(9)
+  
+  proc row(name: string; samples: seq[int]; calls: int) =
+    if samples.len == 0: return
+    let avg = sum(samples) div samples.len
+    let callsAvg = if calls > 0: formatFloat(calls / samples.len, ffDecimal, 1) else: "-"
+    echo name.alignLeft(16), ($samples.len).align(8), callsAvg.align(8), ($min(samples)).align(10), ($avg).align(10), ($max(samples)).align(10), pct(avg).align(9)
+  
+  for name in zoneOrder:
+    var samples: seq[int]
+    var calls = 0
+    for n in nums:
+      let f = frames[n]
+      if name in f.zones:
+        samples.add f.zones[name].cycles
+        calls += f.zones[name].calls
+    row(name, samples, calls)
+  
+  var busy: seq[int]
+  for n in nums:
+    busy.add frames[n].busy
+  row("(total)", busy, 0)
+  
+  # Frames where the top-level zones took longer than the budget.
+  var over: seq[int]
+  for n in nums:
+    if frames[n].busy > opts.budget:
+      over.add n
+  
+  # Frames that took more than one refresh to complete, e.g. because the
+  # game missed a VBlank.
+  var late: seq[int]
+  for n in nums:
+    if frames[n].elapsed > cyclesPerFrame + cyclesPerFrame div 2:
+      late.add n
+  
+  echo ""
+  echo &"Budget: {opts.budget} cycles ({pct(opts.budget)} of a frame)"
+  if over.len == 0:
+    echo "No frames over budget."
+  else:
+    echo &"{over.len} frames over budget:"
+    for n in over:
+      let f = frames[n]
+      var worst = ""
+      var worstCycles = -1
+      for name, z in f.zones:
+        if z.cycles > worstCycles:
+          worst = name
+          worstCycles = z.cycles
+      echo &"  frame {n}: {f.busy} cycles ({pct(f.busy)}), most in '{worst}' ({worstCycles})"
+  
+  if late.len > 0:
+    echo ""
+    let lateList = late.join(", ")
+    echo &"{late.len} frames took longer than one refresh: {lateList}"
+
+
+proc profinfo*(p: var OptParser, progName: static[string] = "profinfo") =
+  
+  const helpMsg = """
+Usage:
+  """ & progName & """ [options] logfile.txt
+
+Summarise the output of `profileDump()` from natu/profiler, as found
+in an mGBA log file or in the stdout of the SDL build of a game.
+
+Options:
+  --budget:N     Flag frames where the top-level zones took more than N cycles.
+                 Defaults to """ & $cyclesPerFrame & """, i.e. one whole frame.
+  --vblank       Use the length of VBlank (83776 cycles) as the budget, for
+                 code that must finish before the display starts drawing.
+"""
+  var opts = Options(
+    filename: "",
+    budget: cyclesPerFrame,
+  )
+  
+  for kind, k, v in p.getopt():
+    case kind
+    of cmdLongOption, cmdShortOption:
+      case k
+      of "budget": opts.budget = parseInt(v)
+      of "vblank": opts.budget = 68 * 1232
+      of "help": quit(helpMsg, 0)
+      else: quit("Unrecognised option '" & k & "'\n" & helpMsg)
+    of cmdArgument:
+      opts.filename = k
+    of cmdEnd:
+      discard
+  
+  if opts.filename == "":
+    quit("No filename specified.\n" & helpMsg, 0)
+  elif not fileExists(opts.filename):
+    quit("Could not find " & opts.filename, 1)
+  
+  run(opts)
+
+when isMainModule:
+  var p = initOptParser(shortNoVal = {}, longNoVal = @["vblank"])
+  profinfo(p)
@@ -0,0 +1,188 @@
+## Reference vectors for the SDL backend's versions of the BIOS memory and
+## affine routines (`natu/private/sdl/bios.c`), plus how fast they run.
+## 
+## The affine vectors come from the BIOS sine table and its order of shifts,
+## and include cases where a rounded table or shifting the negated product
+## would be one off. Run it with `-d:release` to get meaningful numbers:
+## 
+##   nim c -r -d:release tests/tbios.nim
+
+import std/[os, monotimes, times, strutils, sequtils]
+import natu/private/sdl/bios  # compiles bios.c
+
+const rootDir = currentSourcePath().parentDir.parentDir
+
+{.passC: "-I" & rootDir / "vendor/libtonc/include".}
+
+type
+  ObjAffineSource = object
+    sx, sy: int16
+    alpha: uint16
+    pad: uint16  # the C struct is word aligned
+
+  BgAffineSource = object
+    texX, texY: int32
+    scrX, scrY: int16
+    sx, sy: int16
+    alpha: uint16
+    pad: uint16
+
+  BgAffineDest = object
+    pa, pb, pc, pd: int16
+    dx, dy: int32
+
+  BitUnPackInfo = object
+    srcLen: uint16
+    srcBpp, dstBpp: uint8
+    dstOfs: uint32
+
+const
+  csFill = 1'u32 shl 24
+  csCpy32 = 1'u32 shl 26
+  bupAllOfs = 1'u32 shl 31
+
+proc CpuSet(src, dst: pointer; mode: uint32) {.importc, cdecl.}
+proc CpuFastSet(src, dst: pointer; mode: uint32) {.importc, cdecl.}
+proc BitUnPack(src, dst: pointer; bup: ptr BitUnPackInfo) {.importc, cdecl.}
+proc ObjAffineSet(src: ptr ObjAffineSource; dst: pointer; num, offset: int32) {.importc, cdecl.}
+proc BgAffineSet(src: ptr BgAffineSource; dst: ptr BgAffineDest; num: int32) {.importc, cdecl.}
+
+# bios.c expects these to be provided by the SDL runtime.
+proc natuPanic(msg1, msg2: cstring) {.exportc, cdecl.} =
+  quit("natuPanic: " & $msg1 & " " & $msg2)
+proc natuGetRegBase(): uint {.exportc, cdecl.} = 0
+proc natuReqSoftReset() {.exportc, cdecl.} = discard
+
+var failures = 0
+
+template check(cond: bool; msg: string) =
+  if not cond:
+    echo "FAIL: ", msg
+    inc failures
+
+
+# Affine
+# ------
+
+proc checkObj(sx, sy: int16; alpha: uint16; expected: array[4, int16]) =
+  var src = ObjAffineSource(sx: sx, sy: sy, alpha: alpha)
+  var dst: array[4, int16]
+  ObjAffineSet(addr src, addr dst, 1, 2)
+  check(dst == expected, "ObjAffineSet(" & $sx & ", " & $sy & ", 0x" & toHex(alpha) & ") gave " & $dst & ", expected " & $expected)
+
+checkObj(0x100, 0x100, 0x0000, [0x100'i16, 0, 0, 0x100])
+checkObj(0x100, 0x100, 0x4000, [0'i16, -0x100, 0x100, 0])
+checkObj(0x100, 0x100, 0x8000, [-0x100'i16, 0, 0, -0x100])
+checkObj(0x100, 0x100, 0x0200, [255'i16, -12, 12, 255])
+checkObj(0x100, 0x100, 0x02ff, [255'i16, -12, 12, 255])  # only the top 8 bits of the angle are used
+checkObj(0x4000, 0x4000, 0x0200, [0x3fec'i16, -0x323, 0x323, 0x3fec])  # the table is truncated, not rounded
+checkObj(-0x100, 0x100, 0x0200, [-256'i16, 13, 12, 255])  # pb is the negated shift, not the shifted negation
+
+block:
+  # With sy = 0x4000, pc is exactly the sine table entry for the angle.
+  let expected = [0x0000'i16, 0x0192, 0x0323, 0x04b5, 0x0645, 0x07d5, 0x0964, 0x0af1,
+                  0x0c7c, 0x0e05, 0x0f8c, 0x1111, 0x1294, 0x1413, 0x158f, 0x1708]
+  for i, v in expected:
+    var src = ObjAffineSource(sx: 0x4000, sy: 0x4000, alpha: uint16(i shl 8))
+    var dst: array[4, int16]
+    ObjAffineSet(addr src, addr dst, 1, 2)
+    check(dst[2] == v, "sine table entry " & $i & " is 0x" & toHex(dst[2]) & ", expected 0x" & toHex(v))
+
+block:
+  # Rotate 90 degrees around screen point (120, 80), with texture point (128, 64) ending up there.
+  var src = BgAffineSource(texX: 128 shl 8, texY: 64 shl 8, scrX: 120, scrY: 80, sx: 0x100, sy: 0x100, alpha: 0x4000)
+  var dst: BgAffineDest
+  BgAffineSet(addr src, addr dst, 1)
+  let expected = BgAffineDest(pa: 0, pb: -256, pc: 256, pd: 0, dx: 0xd000, dy: -14336)
+  check(dst == expected, "BgAffineSet gave " & $dst & ", expected " & $expected)
+
+
+# Memory
+# ------
+
+block:
+  var src = [1'u16, 2, 3, 4, 5, 6, 7, 8]
+  var dst: array[8, uint16]
+  CpuSet(addr src, addr dst, 5)
+  check(dst == [1'u16, 2, 3, 4, 5, 0, 0, 0], "CpuSet 16-bit copy gave " & $dst)
+
+block:
+  var v = 0xabcd'u16
+  var dst: array[4, uint16]
+  CpuSet(addr v, addr dst, 3 or csFill)
+  check(dst == [0xabcd'u16, 0xabcd, 0xabcd, 0], "CpuSet 16-bit fill gave " & $dst)
+
+block:
+  var src = [0x11111111'u32, 0x22222222, 0x33333333, 0x44444444]
+  var dst: array[4, uint32]
+  CpuSet(addr src, addr dst, 3 or csCpy32)
+  check(dst == [0x11111111'u32, 0x22222222, 0x33333333, 0], "CpuSet 32-bit copy gave " & $dst)
+
+block:
+  var v = 0xdeadbeef'u32
+  var dst: array[3, uint32]
+  CpuSet(addr v, addr dst, 2 or csCpy32 or csFill)
+  check(dst == [0xdeadbeef'u32, 0xdeadbeef, 0], "CpuSet 32-bit fill gave " & $dst)
+
+block:
+  # The BIOS copies forwards, so copying onto the next halfword smears the first one.
+  var buf = [1'u16, 2, 3, 4, 5]
+  CpuSet(addr buf[0], addr buf[1], 4)
+  check(buf == [1'u16, 1, 1, 1, 1], "CpuSet overlapping copy gave " & $buf)
+
+block:
+  # CpuFastSet rounds the count up to a multiple of 8 words.
+  var v = 7'u32
+  var dst: array[20, uint32]
+  CpuFastSet(addr v, addr dst, 3 or csFill)
+  check(dst.count(7) == 8, "CpuFastSet fill of 3 words wrote " & $dst.count(7))
+  var src: array[20, uint32]
+  for i in 0..<20: src[i] = uint32(i + 1)
+  var dst2: array[20, uint32]
+  CpuFastSet(addr src, addr dst2, 9)
+  check(dst2[0..15] == src[0..15] and dst2[16..19] == @[0'u32, 0, 0, 0], "CpuFastSet copy of 9 words gave " & $dst2)
+
+proc checkBitUnPack(src: openArray[uint8]; srcBpp, dstBpp: int; ofs: uint32; expected: uint32) =
+  var info = BitUnPackInfo(srcLen: src.len.uint16, srcBpp: srcBpp.uint8, dstBpp: dstBpp.uint8, dstOfs: ofs)
+  var dst: array[2, uint32]
+  BitUnPack(unsafeAddr src[0], addr dst, addr info)
+  check(dst[0] == expected, "BitUnPack " & $srcBpp & "->" & $dstBpp & " gave 0x" & toHex(dst[0]) & ", expected 0x" & toHex(expected))
+
+checkBitUnPack([0x1b'u8], 2, 8, 0, 0x00010203'u32)
+checkBitUnPack([0x1b'u8], 2, 8, 5, 0x00060708'u32)  # zeroes stay zero
+checkBitUnPack([0x1b'u8], 2, 8, 5 or bupAllOfs, 0x05060708'u32)
+checkBitUnPack([0xa5'u8], 1, 4, 0, 0x10100101'u32)  # 1bpp font to 4bpp tiles
+checkBitUnPack([0x21'u8, 0x43], 4, 8, 0, 0x04030201'u32)
+
+
+# Speed
+# -----
+
+proc bench(name, unit: string; perRep: int; body: proc ()) =
+  var reps = 0
+  let start = getMonoTime()
+  var elapsed: Duration
+  while true:
+    body()
+    inc reps
+    elapsed = getMonoTime() - start
+    if elapsed.inMilliseconds >= 100: break
+  let rate = (perRep * reps).float / (elapsed.inNanoseconds.float / 1e9) / 1e6
+  echo alignLeft(name, 28), align(formatFloat(rate, ffDecimal, 1) & " " & unit, 16)
+
+var a, b: array[0x4000, uint32]
+var fillValue = 0x12345678'u32
+var objSrc: array[128, ObjAffineSource]
+var objDst: array[128 * 4, int16]
+for i in 0..<128:
+  objSrc[i] = ObjAffineSource(sx: int16(0x80 + i), sy: int16(0x100 - i), alpha: uint16(i * 512))
+
+echo ""
+bench("CpuSet 16-bit copy", "MB/s", sizeof(a), proc () = CpuSet(addr a, addr b, uint32(sizeof(a) div 2)))
+bench("CpuSet 32-bit copy", "MB/s", sizeof(a), proc () = CpuSet(addr a, addr b, uint32(a.len) or csCpy32))
+bench("CpuSet 32-bit fill", "MB/s", sizeof(a), proc () = CpuSet(addr fillValue, addr b, uint32(a.len) or csCpy32 or csFill))
+bench("CpuFastSet copy", "MB/s", sizeof(a), proc () = CpuFastSet(addr a, addr b, uint32(a.len)))
+bench("ObjAffineSet", "M matrices/s", objSrc.len, proc () = ObjAffineSet(addr objSrc[0], addr objDst, objSrc.len.int32, 2))
+
+doAssert(failures == 0, $failures & " failures")
+echo "ok"
@@ -0,0 +1,190 @@
+## Round-trip tests for the asset compressors in `natu/tools/compression`.
+## 
+## Everything is decompressed again by the SDL backend's versions of the BIOS
+## routines (`natu/private/sdl/bios.c`), which follow the formats in GBATEK.
+## The compression ratio and decode speed for each kind of data is printed
+## along the way, as a rough benchmark, so run it with `-d:release`:
+## 
+##   nim c -r -d:release tests/tcompression.nim
+
+import std/[random, os, monotimes, times, strutils, strformat]
+import natu/tools/compression
+import natu/private/sdl/bios  # compiles bios.c, provides the RLE decoder
+
+const rootDir = currentSourcePath().parentDir.parentDir
+
+{.passC: "-I" & rootDir / "vendor/libtonc/include".}
+
+proc LZ77UnCompWram(src, dst: pointer) {.importc, cdecl.}
+proc HuffUnComp(src, dst: pointer) {.importc, cdecl.}
+proc RLUnCompWram(src, dst: pointer) {.importc, cdecl.}
+proc Diff8bitUnFilterWram(src, dst: pointer) {.importc, cdecl.}
+proc Diff16bitUnFilter(src, dst: pointer) {.importc, cdecl.}
+
+# bios.c expects these to be provided by the SDL runtime.
+proc natuPanic(msg1, msg2: cstring) {.exportc, cdecl.} =
+  quit("natuPanic: " & $msg1 & " " & $msg2)
+proc natuGetRegBase(): uint {.exportc, cdecl.} = 0
+proc natuReqSoftReset() {.exportc, cdecl.} = discard
+
+
+type Codec = enum
+  cLz77, cHuff4, cHuff8, cRle, cDiff8, cDiff16
+
+proc encode(codec: Codec; data: string): string =
+  case codec
+  of cLz77: lz77Compress(data)
+  of cHuff4: huffCompress(data, 4)
+  of cHuff8: huffCompress(data, 8)
+  of cRle: compress(data, Rle)
+  of cDiff8, cDiff16:
+    # The converters store filtered data without a header, add one so the BIOS routines can read it.
+    let unit = if codec == cDiff8: 1 else: 2
+    let n = data.len
+    char(0x80 or unit) & char(n and 0xff) & char((n shr 8) and 0xff) & char((n shr 16) and 0xff) & diffFilter(data, unit)
+
+proc decode(codec: Codec; packed: string; size: int): string =
+  result = newString(size + 4)  # Huffman writes whole words.
+  let src = unsafeAddr packed[0]
+  let dst = addr result[0]
+  case codec
+  of cLz77: LZ77UnCompWram(src, dst)
+  of cHuff4, cHuff8: HuffUnComp(src, dst)
+  of cRle: RLUnCompWram(src, dst)
+  of cDiff8: Diff8bitUnFilterWram(src, dst)
+  of cDiff16: Diff16bitUnFilter(src, dst)
+  result.setLen(size)
+
+proc lz77MinDistance(packed: string): int =
+  ## The closest match in an LZ77 stream, which must be at least 2 to be safe for VRAM.
+  result = high(int)
+  let size = ord(packed[1]) or (ord(packed[2]) shl 8) or (ord(packed[3]) shl 16)
+  var i = 4
+  var written = 0
+  while written < size:
+    let flags = ord(packed[i])
+    inc i
+    for b in 0..<8:
+      if written >= size: break
+      if (flags and (0x80 shr b)) != 0:
+        let len = (ord(packed[i]) shr 4) + 3
+        let dist = (((ord(packed[i]) and 0xf) shl 8) or ord(packed[i+1])) + 1
+        result = min(result, dist)
+        written += len
+        i += 2
+      else:
+        inc written
+        inc i
+
+
+# Test data
+# ---------
+
+proc randomData(r: var Rand; n: int): seq[(string, string)] =
+  var s = newString(n)
+  for c in mitems(s): c = char(r.rand(255))
+  result.add ("random bytes", s)
+
+  for c in mitems(s): c = char(r.rand(3))
+  result.add ("4 symbols", s)
+
+  for c in mitems(s): c = '\7'
+  result.add ("one symbol", s)
+
+  var palette: array[32, char]
+  for c in mitems(palette): c = char(r.rand(255))
+  for c in mitems(s): c = if r.rand(1.0) < 0.3: r.sample(palette) else: '\0'
+  result.add ("sparse", s)
+
+  for c in mitems(s): c = char(r.rand(r.rand(255)))
+  result.add ("skewed", s)
+
+  # 4bpp tiles made of runs, like typical pixel art.
+  var i = 0
+  while i < n:
+    let run = r.rand(1..24)
+    let px = r.rand(15)
+    for j in 0..<min(run, n - i):
+      s[i+j] = char(px or (px shl 4))
+    i += run
+  result.add ("runs", s)
+
+proc realData(): seq[(string, string)] =
+  var files = @[rootDir / "vendor/acsl/fonts/font5x8.bin"]
+  for f in walkFiles(rootDir / "vendor/libtonc/src/font/*.png"): files.add f
+  files.add rootDir / "natu/tools/compression.nim"
+  files.add rootDir / "natu/private/sdl/bios.c"
+  for f in files:
+    var s = readFile(f)
+    while (s.len mod 4) != 0: s.add '\0'
+    result.add (f.relativePath(rootDir), s)
+
+
+# Checks
+# ------
+
+var failures = 0
+
+proc check(name: string; data: string) =
+  var line = alignLeft(name, 36) & align($data.len, 8)
+  for codec in Codec:
+    let packed = encode(codec, data)
+    if packed.len == 0:
+      doAssert(codec == cHuff8, "Only 8-bit Huffman is allowed to give up")
+      line.add align("-", 17)
+      continue
+
+    if decode(codec, packed, data.len) != data:
+      echo "FAIL: ", codec, " round trip of ", name, " (", data.len, " bytes)"
+      inc failures
+    if codec == cLz77 and lz77MinDistance(packed) < 2:
+      echo "FAIL: LZ77 match closer than 2 bytes in ", name
+      inc failures
+
+    # time the decoder over at least ~10ms
+    var reps = 0
+    let start = getMonoTime()
+    var elapsed: Duration
+    while true:
+      discard decode(codec, packed, data.len)
+      inc reps
+      elapsed = getMonoTime() - start
+      if elapsed.inMilliseconds >= 10: break
+    let mbps = (data.len * reps).float / (elapsed.inNanoseconds.float / 1e9) / 1e6
+    line.add align(formatFloat(100 * packed.len / data.len, ffDecimal, 1) & "%", 8)
+    line.add align(formatFloat(mbps, ffDecimal, 0) & "MB/s", 9)
+  echo line
+
+var header = alignLeft("data", 36) & align("bytes", 8)
+for codec in Codec: header.add align($codec & " size/speed", 17)
+echo header
+
+var r = initRand(1)
+for n in [4, 8, 32, 100, 1000, 4096, 20000]:
+  let n = n - (n mod 4)
+  for (name, s) in randomData(r, n):
+    check(&"{name} ({n})", s)
+
+for (name, s) in realData():
+  check(name, s)
+
+# Data that isn't a multiple of 4 bytes, as the converters handle it. Huffman
+# can't be used for it, so it should fall back to a kind that round trips.
+for n in 1..13:
+  let data = randomData(r, n)[5][1]
+  for kind in [Rle, Lz77, Huff]:
+    let used = usableKind(kind, n)
+    if used == Huff and (n mod 4) != 0:
+      echo "FAIL: Huffman chosen for ", n, " bytes"
+      inc failures
+      continue
+    let codec = case used
+      of Rle: cRle
+      of Lz77: cLz77
+      else: cHuff8
+    if decode(codec, compress(data, used), n) != data:
+      echo "FAIL: ", kind, " (as ", used, ") round trip of ", n, " bytes"
+      inc failures
+
+doAssert(failures == 0, $failures & " round trip failures")
+echo "ok"
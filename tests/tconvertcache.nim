@@ -0,0 +1,137 @@
+## Times the graphics and background converters with an empty cache, with a
+## full cache, and after a single input has changed, and checks that a warm
+## run doesn't regenerate anything.
+## 
+## Run it with `-d:release` to get meaningful numbers:
+## 
+##   nim c -r -d:release tests/tconvertcache.nim
+
+import std/[os, random, monotimes, times, strutils]
+import natu/tools/[gfxconvert, bgconvert]
+
+const
+  numGfx = 64
+  numBgs = 16
+
+# A minimal PNG writer (RGBA, uncompressed deflate) so the test has no dependencies.
+
+var crcTable: array[256, uint32]
+for i in 0..255:
+  var c = i.uint32
+  for k in 0..7:
+    c = if (c and 1) != 0: 0xedb88320'u32 xor (c shr 1) else: c shr 1
+  crcTable[i] = c
+
+proc be32(s: var string; v: uint32) =
+  for k in [24, 16, 8, 0]:
+    s.add char((v shr k) and 0xff)
+
+proc addChunk(png: var string; kind, data: string) =
+  png.be32(data.len.uint32)
+  var crc = not 0'u32
+  for c in kind & data:
+    crc = crcTable[(crc xor c.uint32) and 0xff] xor (crc shr 8)
+  png.add kind
+  png.add data
+  png.be32(not crc)
+
+proc writePng(path: string; w, h: int; pixels: seq[uint32]) =
+  var raw: string
+  for y in 0..<h:
+    raw.add '\0'  # no filter
+    for x in 0..<w:
+      raw.be32(pixels[y*w + x])
+
+  var z = "\x78\x01"
+  var pos = 0
+  while true:
+    let n = min(raw.len - pos, 0xffff)
+    let last = pos + n == raw.len
+    z.add char(ord(last))
+    z.add char(n and 0xff) & char(n shr 8)
+    z.add char(not n and 0xff) & char((not n shr 8) and 0xff)
+    z.add raw[pos ..< pos+n]
+    pos += n
+    if last: break
+  var a = 1'u32
+  var b = 0'u32
+  for c in raw:
+    a = (a + c.uint32) mod 65521
+    b = (b + a) mod 65521
+  z.be32((b shl 16) or a)
+
+  var ihdr: string
+  ihdr.be32(w.uint32)
+  ihdr.be32(h.uint32)
+  ihdr.add "\x08\x06\x00\x00\x00"  # 8 bits per channel, RGBA
+
+  var png = "\x89PNG\r\n\x1a\n"
+  png.addChunk("IHDR", ihdr)
+  png.addChunk("IDAT", z)
+  png.addChunk("IEND", "")
+  writeFile(path, png)
+
+# Pixel art made of random runs from a fixed palette, so every image fits in
+# one 16-colour palette and compresses a bit.
+
+var r = initRand(1)
+var colors: seq[uint32]
+for i in 0..14:
+  colors.add (r.rand(0xffffff).uint32 shl 8) or 0xff
+
+proc randomPixels(w, h: int): seq[uint32] =
+  result = newSeq[uint32](w * h)
+  var i = 0
+  while i < result.len:
+    let c = r.sample(colors)
+    for j in 0..<min(r.rand(1..12), result.len - i):
+      result[i] = c
+      inc i
+
+let root = getTempDir() / "natu_tconvertcache"
+let indir = root / "in"
+let outdir = root / "out"
+removeDir(root)
+createDir(indir)
+createDir(outdir)
+
+var gfxTsv, bgTsv: seq[string]
+for i in 0..<numGfx:
+  writePng(indir / "gfx" & $i & ".png", 32, 32 * 4, randomPixels(32, 32 * 4))
+  gfxTsv.add ["gfx" & $i & ".png", "s32x32", "4", $(i div 8), "0", "Lz77"].join("\t")
+for i in 0..<numBgs:
+  writePng(indir / "bg" & $i & ".png", 256, 256, randomPixels(256, 256))
+  # flags = {bfAutoPal}
+  bgTsv.add ["bg" & $i & ".png", "bkReg4bpp", "0", "0", "4", "", "Lz77", "Huff"].join("\t")
+
+writeFile(root / "graphics.tsv", gfxTsv.join("\n"))
+writeFile(root / "backgrounds.tsv", bgTsv.join("\n"))
+
+proc run(what: string) =
+  let t0 = getMonoTime()
+  gfxConvert(root / "graphics.tsv", "config.nims", indir, outdir)
+  let t1 = getMonoTime()
+  bgConvert(root / "backgrounds.tsv", "config.nims", indir, outdir)
+  let t2 = getMonoTime()
+  echo "[", what, "] graphics: ", (t1 - t0).inMilliseconds, "ms, backgrounds: ", (t2 - t1).inMilliseconds, "ms"
+
+let outputs = [outdir / "graphics.c", outdir / "graphics.nim", outdir / "backgrounds.c", outdir / "backgrounds.nim"]
+
+run("cold")
+
+var before: seq[Time]
+for f in outputs: before.add getLastModificationTime(f)
+sleep(1100)  # in case the file system only has 1 second resolution
+
+run("warm")
+
+for i, f in outputs:
+  doAssert(getLastModificationTime(f) == before[i], f & " was regenerated although nothing changed")
+
+writePng(indir / "gfx0.png", 32, 32 * 4, randomPixels(32, 32 * 4))
+writePng(indir / "bg0.png", 256, 256, randomPixels(256, 256))
+
+run("one of each changed")
+
+removeDir(root)
+echo "ok"
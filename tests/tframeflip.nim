@@ -0,0 +1,108 @@
+## Round-trip tests for flipped frame deduplication: frames flipped by
+## `natu gfxconvert` (`flipFrame`, `findDuplicate`) must come back out unchanged
+## when copied by the runtime (`natu/private/frameflip`), plus how fast that is.
+## 
+## Run it with `-d:release` to get meaningful numbers:
+## 
+##   nim c -r -d:release tests/tframeflip.nim
+
+import std/[random, monotimes, times, strutils, tables]
+import natu/tools/gfxconvert
+import natu/private/[compkind, frameflip]
+
+const
+  frameHFlip = 1 shl 30
+  frameVFlip = 1 shl 31
+  frameOffsetMask = frameHFlip - 1
+
+var failures = 0
+
+template check(cond: bool; msg: string) =
+  if not cond:
+    echo "FAIL: ", msg
+    inc failures
+
+proc runtimeFlip(frame: string; w, h, bpp: int; hflip, vflip: bool): string =
+  ## Copy a frame the way `copyFrame` does, through word-aligned buffers.
+  var src = newSeq[uint32](frame.len div 4)
+  var dst = newSeq[uint32](frame.len div 4)
+  copyMem(addr src[0], unsafeAddr frame[0], frame.len)
+  copyFrameFlipped(addr dst[0], addr src[0], w, h, bpp, hflip, vflip)
+  result = newString(frame.len)
+  copyMem(addr result[0], addr dst[0], frame.len)
+
+proc randomFrame(r: var Rand; w, h, bpp: int): string =
+  result = newString(w * h * bpp div 8)
+  for c in mitems(result):
+    c = char(r.rand(255))
+
+let flips = [(false, false), (true, false), (false, true), (true, true)]
+let sizes = [(8, 8), (16, 8), (8, 16), (32, 32), (64, 32), (64, 64)]
+
+check(flipRow4(0x76543210'u32) == 0x01234567'u32, "flipRow4 gave 0x" & toHex(flipRow4(0x76543210'u32)))
+check(flipBytes(0x03020100'u32) == 0x00010203'u32, "flipBytes gave 0x" & toHex(flipBytes(0x03020100'u32)))
+
+var r = initRand(1)
+
+for bpp in [4, 8]:
+  for (w, h) in sizes:
+    let name = $w & "x" & $h & " " & $bpp & "bpp"
+    for _ in 0..<20:
+      let frame = randomFrame(r, w, h, bpp)
+
+      # The converter and the runtime agree on what each flip means,
+      # and flipping twice gives back the original.
+      for (hflip, vflip) in flips:
+        let flipped = flipFrame(frame, w, h, bpp, hflip, vflip)
+        check(runtimeFlip(frame, w, h, bpp, hflip, vflip) == flipped,
+          name & ": converter and runtime disagree on hflip=" & $hflip & " vflip=" & $vflip)
+        check(runtimeFlip(flipped, w, h, bpp, hflip, vflip) == frame,
+          name & ": hflip=" & $hflip & " vflip=" & $vflip & " doesn't round-trip")
+
+      # Every flipped copy of a stored frame is found as a duplicate of it, and
+      # copying the stored frame with the entry's flip bits gives back the copy.
+      const pos = 0x40
+      let lookup = {"None:" & frame: pos}.toTable
+      for (hflip, vflip) in flips:
+        let variant = flipFrame(frame, w, h, bpp, hflip, vflip)
+        let entry = findDuplicate(lookup, variant, None, w, h, bpp, canFlip = true)
+        if entry == -1:
+          check(false, name & ": hflip=" & $hflip & " vflip=" & $vflip & " wasn't deduplicated")
+          continue
+        check((entry and frameOffsetMask) == pos, name & ": the entry points at " & $(entry and frameOffsetMask))
+        let copied = runtimeFlip(frame, w, h, bpp, (entry and frameHFlip) != 0, (entry and frameVFlip) != 0)
+        check(copied == variant, name & ": hflip=" & $hflip & " vflip=" & $vflip & " was deduplicated to the wrong frame")
+        if hflip or vflip:
+          check(findDuplicate(lookup, variant, None, w, h, bpp, canFlip = false) == -1,
+            name & ": a flipped frame matched without DedupeFlips")
+        check(findDuplicate(lookup, variant, Lz77, w, h, bpp, canFlip = true) == -1,
+          name & ": a frame matched one stored with a different compression")
+
+
+# Speed
+# -----
+
+proc bench(name: string; body: proc ()) =
+  var reps = 0
+  let start = getMonoTime()
+  var elapsed: Duration
+  while true:
+    body()
+    inc reps
+    elapsed = getMonoTime() - start
+    if elapsed.inMilliseconds >= 100: break
+  let ns = elapsed.inNanoseconds.float / reps.float
+  echo alignLeft(name, 28), align(formatFloat(ns, ffDecimal, 0) & " ns/frame", 16)
+
+var src, dst: array[64 * 64 div 4, uint32]  # 64x64 8bpp
+for v in mitems(src): v = r.next().uint32
+
+echo ""
+for bpp in [4, 8]:
+  let bytes = 64 * 64 * bpp div 8
+  bench("copy 64x64 " & $bpp & "bpp", proc () = copyMem(addr dst, addr src, bytes))
+  bench("hflip 64x64 " & $bpp & "bpp", proc () = copyFrameFlipped(addr dst, addr src, 64, 64, bpp, true, false))
+  bench("hflip+vflip 64x64 " & $bpp & "bpp", proc () = copyFrameFlipped(addr dst, addr src, 64, 64, bpp, true, true))
+
+doAssert(failures == 0, $failures & " failures")
+echo "ok"
@@ -0,0 +1,84 @@
+## Checks that `natu/kit/obj_buffer` only writes the object attributes when
+## flushing, so affine matrices written straight into `objAffMem` survive.
+## 
+## OAM is an ordinary block of memory in the SDL flavour of Natu, so this runs
+## on the host (`tobjbuffer.nims` sets it up):
+## 
+##   nim c -r tests/tobjbuffer.nim
+
+import natu/[video, math]
+import natu/private/sdl/applib
+import natu/kit/obj_buffer
+
+# applib expects these to be provided by the game.
+proc natuNimMain() {.exportc.} = discard
+proc natuUpdate() {.exportc.} = discard
+
+var mem: NatuAppMem
+natuMem = addr mem
+
+var failures = 0
+
+template check(cond: bool; msg: string) =
+  if not cond:
+    echo "FAIL: ", msg
+    inc failures
+
+proc matrix(i: int): array[4, OamInt] =
+  [OamInt(0x100 + i), OamInt(-i), OamInt(i), OamInt(0x100 - i)]
+
+proc writeMatrices =
+  for i in 0..<NatuNumMatrices:
+    let m = matrix(i)
+    objAffMem[i].pa = m[0]
+    objAffMem[i].pb = m[1]
+    objAffMem[i].pc = m[2]
+    objAffMem[i].pd = m[3]
+
+proc checkMatrices(what: string) =
+  for i in 0..<NatuNumMatrices:
+    let a = objAffMem[i]
+    let got = [a.pa, a.pb, a.pc, a.pd]
+    if got != matrix(i):
+      check(false, what & " changed matrix " & $i & " to " & $got & ", expected " & $matrix(i))
+      return
+
+proc checkObjs(what: string) =
+  for i in 0..<NatuNumObjs:
+    let o = objMem[i]
+    let expected = objBuf[i]
+    if o.attr0 != expected.attr0 or o.attr1 != expected.attr1 or o.attr2 != expected.attr2:
+      check(false, what & " didn't copy object " & $i)
+      return
+
+writeMatrices()
+
+# Flushing the initial (hidden) objects.
+flushObjs()
+checkMatrices("the first flush")
+checkObjs("the first flush")
+
+# Some objects set through `setObj`, including ones that use the matrices.
+for i in 0..<NatuNumObjs:
+  setObj(i, initObj(pos = vec2i(i, i div 2), tileId = i, mode = omAffine, affId = i mod 32))
+flushObjs()
+checkMatrices("flushing after setObj")
+checkObjs("flushing after setObj")
+
+# Writing through `objBuf` marks every object.
+for i in 0..<NatuNumObjs:
+  objBuf[i].palId = i mod 16
+flushObjs()
+checkMatrices("flushing after objBuf")
+checkObjs("flushing after objBuf")
+
+# A matrix written between flushes must survive the next one too.
+objAffMem[3].pa = 0x7ff
+flushObjsAll()
+check(objAffMem[3].pa == 0x7ff, "flushObjsAll overwrote a matrix written since the last flush")
+objAffMem[3].pa = matrix(3)[0]
+checkMatrices("flushObjsAll")
+checkObjs("flushObjsAll")
+
+doAssert(failures == 0, $failures & " failures")
+echo "ok"
@@ -0,0 +1,168 @@
+## Replays allocation traces through the obj tile allocator (`natu/private/tilealloc`)
+## and the byte-per-tile first-fit allocator it replaced, checking that both hand
+## out the same tile IDs, and reports the time taken and how fragmented VRAM gets.
+## 
+## Run it with `-d:release` to get meaningful numbers:
+## 
+##   nim c -r -d:release tests/tobjtiles.nim
+
+import std/[random, monotimes, times, strutils, sequtils, math]
+import natu/private/tilealloc
+
+const MaxObjTiles = 1024  # as on GBA
+
+# The previous allocator, except that it returns -1 when it runs out.
+
+type
+  ObjTileState = enum
+    otUnused
+    otUsed
+    otContinue
+  OldAllocator = object
+    objTiles: array[MaxObjTiles+1, ObjTileState]  # length+1 for "null terminator"
+
+proc alloc(a: var OldAllocator; tiles: int; snap = 0): int =
+  var start = 0
+  var n = 0
+  while n < MaxObjTiles:
+    if a.objTiles[n] == otUnused:
+      if (n-start)+1 == tiles:
+        a.objTiles[start] = otUsed
+        for i in start+1 .. n:
+          a.objTiles[i] = otContinue
+        return start
+      n += 1
+    else:
+      n = n shr snap
+      n += 1
+      n = n shl snap
+      start = n
+  -1
+
+proc free(a: var OldAllocator; tileId: int) =
+  a.objTiles[tileId] = otUnused
+  var i = tileId + 1
+  while a.objTiles[i] == otContinue:
+    a.objTiles[i] = otUnused
+    inc(i)
+
+
+# Traces
+# ------
+
+type
+  OpKind = enum opAlloc, opFree
+  Op = object
+    case kind: OpKind
+    of opAlloc:
+      tiles, snap: int
+    of opFree:
+      index: int  # which allocation to free, in the order they were made
+
+proc makeTrace(r: var Rand; steps: int; sizes: openArray[int]; target: float): seq[Op] =
+  ## Random allocations and frees, keeping roughly `target` of VRAM in use.
+  ## Snapping follows `allocObjTiles(g: Graphic)`, i.e. to the size of the allocation.
+  var live: seq[(int, int)]  # (index, tiles)
+  var used, numAllocs = 0
+  for _ in 0..<steps:
+    let wantFree = live.len > 0 and r.rand(1.0) < 0.5 * used.float / (target * MaxObjTiles.float)
+    if wantFree:
+      let i = r.rand(live.high)
+      result.add Op(kind: opFree, index: live[i][0])
+      used -= live[i][1]
+      live.del(i)
+    else:
+      let tiles = r.sample(sizes)
+      result.add Op(kind: opAlloc, tiles: tiles, snap: fastLog2(tiles))
+      live.add (numAllocs, tiles)
+      used += tiles
+      inc numAllocs
+
+type ReplayResult = object
+  ids: seq[int]         # tile ID of each allocation, or -1
+  fragmentation: float  # average share of free tiles outside the largest free run
+
+proc replay(trace: seq[Op]; measure = true): ReplayResult =
+  var a: TileAllocator[MaxObjTiles]
+  var samples = 0
+  for op in trace:
+    case op.kind
+    of opAlloc:
+      result.ids.add a.alloc(op.tiles, op.snap)
+    of opFree:
+      if result.ids[op.index] != -1:
+        a.free(result.ids[op.index])
+    let free = if measure: a.numFree() else: 0
+    if free > 0:
+      result.fragmentation += (free - a.largestFree()) / free
+      inc samples
+  if samples > 0:
+    result.fragmentation /= samples.float
+
+proc replayOld(trace: seq[Op]): seq[int] =
+  var a: OldAllocator
+  for op in trace:
+    case op.kind
+    of opAlloc:
+      result.add a.alloc(op.tiles, op.snap)
+    of opFree:
+      if result[op.index] != -1:
+        a.free(result[op.index])
+
+proc timeIt(body: proc ()): float =
+  ## Average seconds per run, over at least 100ms.
+  var reps = 0
+  let start = getMonoTime()
+  var elapsed: Duration
+  while true:
+    body()
+    inc reps
+    elapsed = getMonoTime() - start
+    if elapsed.inMilliseconds >= 100: break
+  elapsed.inNanoseconds.float / 1e9 / reps.float
+
+
+var failures = 0
+var r = initRand(1)
+
+let traces = [
+  ("small sprites, 50% full", makeTrace(r, 5000, [1, 2, 4, 4, 4, 8], 0.5)),
+  ("small sprites, 90% full", makeTrace(r, 5000, [1, 2, 4, 4, 4, 8], 0.9)),
+  ("mixed sizes, 70% full", makeTrace(r, 5000, [1, 2, 4, 8, 16, 32, 64], 0.7)),
+  ("big sprites, 90% full", makeTrace(r, 5000, [16, 32, 32, 64], 0.9)),
+]
+
+echo alignLeft("trace", 26), align("allocs", 8), align("failed", 8), align("old", 12), align("new", 12), align("frag", 8)
+
+for (name, trace) in traces:
+  let res = replay(trace)
+  let old = replayOld(trace)
+  if res.ids != old:
+    for i in 0..<old.len:
+      if res.ids[i] != old[i]:
+        echo "FAIL: ", name, ": allocation ", i, " got tile ", res.ids[i], " but the old allocator gave ", old[i]
+        break
+    inc failures
+
+  let oldTime = timeIt(proc () = discard replayOld(trace))
+  let newTime = timeIt(proc () = discard replay(trace, measure = false))
+  let perOp = proc (t: float): string = formatFloat(t / trace.len.float * 1e9, ffDecimal, 0) & "ns/op"
+  echo alignLeft(name, 26), align($res.ids.len, 8), align($res.ids.count(-1), 8),
+    align(perOp(oldTime), 12), align(perOp(newTime), 12),
+    align(formatFloat(100 * res.fragmentation, ffDecimal, 1) & "%", 8)
+
+# Freeing something that isn't the start of an allocation must leave everything else alone.
+block:
+  var a: TileAllocator[MaxObjTiles]
+  let x = a.alloc(4)
+  let y = a.alloc(4)
+  doAssert(x == 0 and y == 4)
+  if a.free(x + 1) != 0 or a.free(MaxObjTiles - 4) != 0 or a.free(-1) != 0 or a.numFree() != MaxObjTiles - 8:
+    echo "FAIL: freeing a tile that doesn't start an allocation changed something"
+    inc failures
+  if a.alloc(MaxObjTiles) != -1:
+    echo "FAIL: an allocation that can't fit should return -1"
+    inc failures
+
+doAssert(failures == 0, $failures & " failures")
+echo "ok"
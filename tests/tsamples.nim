@@ -0,0 +1,201 @@
+## Round-trip tests for the SDL soundbank's sample formats (`natu/private/sdl/samples`),
+## plus the size of each format, how fast it converts and decodes compared with
+## plain floats, and how much memory stays resident on new and old hosts.
+## 
+## Run it with `-d:release` to get meaningful numbers:
+## 
+##   nim c -r -d:release tests/tsamples.nim
+
+import std/[math, random, monotimes, times, strutils]
+import natu/private/sdl/[appcommon, samples]
+
+type TestSignal = object
+  name: string
+  channels: int
+  pcm: seq[int16]
+  minSnr: float  # for ADPCM, in dB
+
+proc signal(name: string; channels, len: int; f: proc (i, c: int): float): TestSignal =
+  # ADPCM takes a few samples to adapt to the signal, so don't expect much of very short ones.
+  let minSnr = if len >= sampleBlockLen: 20.0 else: 0.0
+  result = TestSignal(name: name, channels: channels, pcm: newSeq[int16](len * channels), minSnr: minSnr)
+  for i in 0..<len:
+    for c in 0..<channels:
+      result.pcm[i*channels + c] = int16(clamp(f(i, c), -32768.0, 32767.0))
+
+var r = initRand(1)
+
+var signals: seq[TestSignal]
+for len in [1, 2, 504, 505, 506, 1010, 22050]:
+  signals.add signal("sine " & $len, 1, len, proc (i, c: int): float =
+    16000 * sin(2 * PI * 440 * i.float / 22050))
+signals.add signal("stereo sine", 2, 22050, proc (i, c: int): float =
+  16000 * sin(2 * PI * (440 + 110 * c).float * i.float / 22050))
+signals.add signal("sine + noise", 1, 22050, proc (i, c: int): float =
+  12000 * sin(2 * PI * 300 * i.float / 22050) + r.gauss(0, 1000))
+signals.add signal("chirp", 2, 22050, proc (i, c: int): float =
+  16000 * sin(2 * PI * (100 + i / 10) * i.float / 22050))
+signals.add signal("full scale square", 1, 5000, proc (i, c: int): float =
+  if (i div 50) mod 2 == 0: 32767.0 else: -32768.0)
+signals[^1].minSnr = 0  # only here to check the decoder clamps properly
+
+# Build a soundbank the same way `natu mixconvert` does.
+
+var bank = "NSB1"
+var infos: seq[SampleInfo]
+var numFloats = 0'u32
+for s in signals:
+  for encoding in SampleEncoding:
+    while (bank.len mod 4) != 0:
+      bank.add '\0'
+    var info = SampleInfo(
+      channels: s.channels.uint16,
+      sampleRate: 22050,
+      length: (s.pcm.len div s.channels).uint32,
+      encoding: encoding,
+      byteStart: bank.len.uint32,
+    )
+    case encoding
+    of SampleInt16:
+      for v in s.pcm:
+        bank.add char(cast[uint16](v) and 0xff)
+        bank.add char(cast[uint16](v) shr 8)
+    of SampleAdpcm:
+      bank.add adpcmEncode(s.pcm, s.channels)
+    info.byteEnd = bank.len.uint32
+    info.dataStart = numFloats
+    numFloats += info.length * info.channels.uint32
+    info.dataEnd = numFloats
+    infos.add info
+
+let data: pointer = addr bank[0]
+var failures = 0
+
+template check(cond: bool; msg: string) =
+  if not cond:
+    echo "FAIL: ", msg
+    inc failures
+
+# Whole bank, as given to hosts that only understand floats.
+
+var floats: seq[float32]
+let p = hostSampleData(1, infos, data, floats)
+check(p == pointer(addr floats[0]) and floats.len == numFloats.int, "old hosts should get the decoded floats")
+check(hostSampleData(NatuApiVersion, infos, data, floats) == data, "current hosts should get the soundbank itself")
+
+for i, info in infos:
+  let s = signals[i div 2]
+  let decoded = floats[info.dataStart.int ..< info.dataEnd.int]
+  check(decoded.len == s.pcm.len, s.name & " has the wrong length")
+
+  case info.encoding
+  of SampleInt16:
+    for j, v in s.pcm:
+      if decoded[j] * 32768f != v.float32:
+        check(false, s.name & " (Int16) differs at " & $j)
+        break
+
+  of SampleAdpcm:
+    # The first sample of each block is stored as-is.
+    for j in countup(0, s.pcm.len div s.channels - 1, sampleBlockLen):
+      for c in 0..<s.channels:
+        check(decoded[j*s.channels + c] * 32768f == s.pcm[j*s.channels + c].float32,
+          s.name & " (ADPCM) block at " & $j & " doesn't start with the original sample")
+    var power, noise = 0.0
+    for j, v in s.pcm:
+      power += v.float * v.float
+      noise += (decoded[j].float * 32768 - v.float) ^ 2
+    if noise > 0:
+      let snr = 10 * log10(power / noise)
+      check(snr >= s.minSnr, s.name & " (ADPCM) SNR is only " & formatFloat(snr, ffDecimal, 1) & "dB")
+
+# Random access, as used by the mixer when seeking or looping.
+
+for i, info in infos:
+  let ch = info.channels.int
+  for _ in 0..20:
+    let first = r.rand(info.length.int - 1)
+    var dest = newSeq[float32](r.rand(1..2000) * ch)
+    let n = decodeSamples(info, data, first, dest)
+    check(n == min(dest.len div ch, info.length.int - first), "decodeSamples returned the wrong count")
+    for j in 0 ..< n * ch:
+      if dest[j] != floats[info.dataStart.int + first*ch + j]:
+        check(false, signals[i div 2].name & " " & $info.encoding & " decodes differently from sample " & $first)
+        break
+
+# Speed and size, compared with the old format where the soundbank held floats.
+# Streaming one block at a time is how the mixer decodes. With floats it read
+# them straight from the soundbank, so copying a block of them is the baseline.
+
+proc timeIt(body: proc ()): float =
+  ## Average seconds per run, over at least 100ms.
+  var reps = 0
+  let start = getMonoTime()
+  var elapsed: Duration
+  while true:
+    body()
+    inc reps
+    elapsed = getMonoTime() - start
+    if elapsed.inMilliseconds >= 100: break
+  elapsed.inNanoseconds.float / 1e9 / reps.float
+
+proc rate(samples: int; seconds: float): string =
+  formatFloat(samples.float / seconds / 1e6, ffDecimal, 1) & "M samples/s"
+
+let chirpSignal = signals[^2]
+let chirp = infos[signals.len * 2 - 4 ..< signals.len * 2 - 2]
+let chirpLen = chirp[0].length.int
+let chirpChannels = chirp[0].channels.int
+let floatBytes = chirpLen * chirpChannels * sizeof(float32)
+
+echo ""
+echo alignLeft("format", 10), align("bytes", 10), align("vs float", 10), align("convert", 18), align("decode", 18)
+
+block:
+  let floatStart = chirp[0].dataStart.int
+  let convert = timeIt(proc () =
+    var res = newSeq[float32](chirpSignal.pcm.len)
+    for j, v in chirpSignal.pcm:
+      res[j] = v.float32 / 32768f
+    doAssert(res.len > 0))
+  let decode = timeIt(proc () =
+    var buf: array[sampleBlockLen * 2, float32]
+    for blk in 0..<numBlocks(chirp[0]):
+      let n = min(sampleBlockLen, chirpLen - blk * sampleBlockLen) * chirpChannels
+      copyMem(addr buf[0], addr floats[floatStart + blk * sampleBlockLen * chirpChannels], n * sizeof(float32)))
+  echo alignLeft("Float", 10), align($floatBytes, 10), align("100.0%", 10),
+    align(rate(chirpLen, convert), 18), align(rate(chirpLen, decode), 18)
+
+for info in chirp:
+  let bytes = (info.byteEnd - info.byteStart).int
+  let convert =
+    case info.encoding
+    of SampleInt16:
+      timeIt(proc () =
+        var res = newStringOfCap(chirpSignal.pcm.len * 2)
+        for v in chirpSignal.pcm:
+          res.add char(cast[uint16](v) and 0xff)
+          res.add char(cast[uint16](v) shr 8)
+        doAssert(res.len > 0))
+    of SampleAdpcm:
+      timeIt(proc () = doAssert(adpcmEncode(chirpSignal.pcm, chirpChannels).len == bytes))
+  let decode = timeIt(proc () =
+    var buf: array[sampleBlockLen * 2, float32]
+    for blk in 0..<numBlocks(info):
+      discard decodeBlock(info, data, blk, buf))
+  let ratio = 100 * bytes / floatBytes
+  echo alignLeft($info.encoding, 10), align($bytes, 10),
+    align(formatFloat(ratio, ffDecimal, 1) & "%", 10),
+    align(rate(chirpLen, convert), 18), align(rate(chirpLen, decode), 18)
+
+# Memory that stays resident for the whole test soundbank. Hosts older than
+# API version 2 get every sample decoded to floats, on top of the soundbank.
+
+echo ""
+echo alignLeft("resident memory", 28), align("bytes", 10)
+echo alignLeft("floats (old format)", 28), align($(numFloats.int * sizeof(float32)), 10)
+echo alignLeft("API v2 host", 28), align($bank.len, 10)
+echo alignLeft("API v1 host", 28), align($(bank.len + floats.len * sizeof(float32)), 10)
+
+doAssert(failures == 0, $failures & " failures")
+echo "ok"
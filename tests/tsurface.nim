@@ -0,0 +1,321 @@
+## Checks libtonc's surface routines (as used by `natu/surfaces`) pixel by pixel
+## against a plain reference built on `get_pixel` and `plot`, and reports how
+## many pixels per second the floodfill, rect and blit routines get through.
+## 
+## The surfaces live in ordinary memory with guard bytes on either side, so
+## this runs on the host. Run it with `-d:release` to get meaningful numbers:
+## 
+##   nim c -r -d:release tests/tsurface.nim
+
+import std/[os, random, monotimes, times, strutils]
+
+const
+  rootDir = currentSourcePath().parentDir.parentDir
+  toncDir = rootDir / "vendor/libtonc"
+  toncFlags = "-O2 -fno-strict-aliasing -DNON_GBA_TARGET -I" & toncDir / "include"
+
+{.passC: "-DNON_GBA_TARGET -I" & toncDir / "include".}
+{.compile(toncDir / "src/tonc_core.c", toncFlags).}
+{.compile(toncDir / "src/tonc_surface.c", toncFlags).}
+{.compile(toncDir / "src/tonc_sbmp16.c", toncFlags).}
+{.compile(toncDir / "src/tonc_sbmp8.c", toncFlags).}
+{.compile(toncDir / "src/tonc_schr4c.c", toncFlags).}
+{.compile(toncDir / "src/tonc_schr4r.c", toncFlags).}
+
+# On the GBA these come from tonc_memcpy.s, which can't be built for the host.
+{.emit: """
+void memcpy16(void *dst, const void *src, unsigned int n) { const u16 *s = src; u16 *d = dst; while(n--) *d++ = *s++; }
+void memcpy32(void *dst, const void *src, unsigned int n) { const u32 *s = src; u32 *d = dst; while(n--) *d++ = *s++; }
+void memset16(void *dst, u16 v, unsigned int n) { u16 *d = dst; while(n--) *d++ = v; }
+void memset32(void *dst, u32 v, unsigned int n) { u32 *d = dst; while(n--) *d++ = v; }
+""".}
+
+{.pragma: tonc, header: "tonc_surface.h".}
+
+type
+  Surface {.importc: "TSurface", tonc.} = object
+    data: ptr uint8
+    pitch: uint32
+    width: uint16
+    height: uint16
+
+  FloodSpan {.importc: "TFloodSpan", tonc.} = object
+    left, right, y, dy: int16
+
+  Kind = enum
+    Bmp16 = 1, Bmp8 = 2, Chr4r = 4, Chr4c = 5
+
+proc srfInit(srf: ptr Surface; kind: cuint; data: pointer; width, height, bpp: cuint; pal: pointer) {.importc, tonc.}
+
+template declare(pre: untyped) =
+  proc `pre GetPixel`(src: ptr Surface; x, y: cint): uint32 {.importc: astToStr(pre) & "_get_pixel", tonc.}
+  proc `pre Plot`(dst: ptr Surface; x, y: cint; clr: uint32) {.importc: astToStr(pre) & "_plot", tonc.}
+  proc `pre Hline`(dst: ptr Surface; x1, y, x2: cint; clr: uint32) {.importc: astToStr(pre) & "_hline", tonc.}
+  proc `pre Rect`(dst: ptr Surface; left, top, right, bottom: cint; clr: uint32) {.importc: astToStr(pre) & "_rect", tonc.}
+  proc `pre Floodfill`(dst: ptr Surface; x, y: cint; clr: uint32): bool {.importc: astToStr(pre) & "_floodfill", tonc.}
+  proc `pre FloodfillEx`(dst: ptr Surface; x, y: cint; clr: uint32; stack: ptr FloodSpan; size: cuint): bool {.importc: astToStr(pre) & "_floodfill_ex", tonc.}
+
+declare(sbmp16)
+declare(sbmp8)
+declare(schr4c)
+declare(schr4r)
+
+proc sbmp16Blit(dst: ptr Surface; dstX, dstY: cint; width, height: cuint; src: ptr Surface; srcX, srcY: cint) {.importc: "sbmp16_blit", tonc.}
+proc sbmp8Blit(dst: ptr Surface; dstX, dstY: cint; width, height: cuint; src: ptr Surface; srcX, srcY: cint) {.importc: "sbmp8_blit", tonc.}
+proc schr4cBlit(dst: ptr Surface; dstX, dstY: cint; width, height: cuint; src: ptr Surface; srcX, srcY: cint) {.importc: "schr4c_blit", tonc.}
+
+const guard = 64
+
+type TestSurface = ref object
+  kind: Kind
+  w, h: int
+  mem: seq[uint8]
+  srf: Surface
+
+proc bpp(kind: Kind): int =
+  case kind
+  of Bmp16: 16
+  of Bmp8: 8
+  of Chr4r, Chr4c: 4
+
+proc numColors(kind: Kind): int = 1 shl bpp(kind)
+
+proc newTestSurface(kind: Kind; w, h: int): TestSurface =
+  result = TestSurface(kind: kind, w: w, h: h)
+  # Room for the pixels, plus padding and guard bytes either side.
+  let bytes = (w + 8) * (h + 8) * bpp(kind) div 8
+  result.mem = newSeq[uint8](bytes + 2 * guard)
+  for b in result.mem.mitems: b = 0xa5
+  srfInit(addr result.srf, ord(kind).cuint, addr result.mem[guard], w.cuint, h.cuint, bpp(kind).cuint, nil)
+
+proc clone(s: TestSurface): TestSurface =
+  result = newTestSurface(s.kind, s.w, s.h)
+  result.mem = s.mem
+  result.srf.data = addr result.mem[guard]
+
+proc guardsOk(s: TestSurface): bool =
+  let used = s.srf.pitch.int * (if s.kind == Chr4c: s.w div 8 elif s.kind == Chr4r: s.h div 8 else: s.h)
+  for i in 0..<guard:
+    if s.mem[i] != 0xa5 or s.mem[guard + used + i] != 0xa5:
+      return false
+  true
+
+proc `[]`(s: TestSurface; x, y: int): uint32 =
+  case s.kind
+  of Bmp16: sbmp16GetPixel(addr s.srf, x.cint, y.cint)
+  of Bmp8: sbmp8GetPixel(addr s.srf, x.cint, y.cint)
+  of Chr4c: schr4cGetPixel(addr s.srf, x.cint, y.cint)
+  of Chr4r: schr4rGetPixel(addr s.srf, x.cint, y.cint)
+
+proc `[]=`(s: TestSurface; x, y: int; clr: uint32) =
+  case s.kind
+  of Bmp16: sbmp16Plot(addr s.srf, x.cint, y.cint, clr)
+  of Bmp8: sbmp8Plot(addr s.srf, x.cint, y.cint, clr)
+  of Chr4c: schr4cPlot(addr s.srf, x.cint, y.cint, clr)
+  of Chr4r: schr4rPlot(addr s.srf, x.cint, y.cint, clr)
+
+proc hline(s: TestSurface; x1, y, x2: int; clr: uint32) =
+  case s.kind
+  of Bmp16: sbmp16Hline(addr s.srf, x1.cint, y.cint, x2.cint, clr)
+  of Bmp8: sbmp8Hline(addr s.srf, x1.cint, y.cint, x2.cint, clr)
+  of Chr4c: schr4cHline(addr s.srf, x1.cint, y.cint, x2.cint, clr)
+  of Chr4r: schr4rHline(addr s.srf, x1.cint, y.cint, x2.cint, clr)
+
+proc rect(s: TestSurface; left, top, right, bottom: int; clr: uint32) =
+  case s.kind
+  of Bmp16: sbmp16Rect(addr s.srf, left.cint, top.cint, right.cint, bottom.cint, clr)
+  of Bmp8: sbmp8Rect(addr s.srf, left.cint, top.cint, right.cint, bottom.cint, clr)
+  of Chr4c: schr4cRect(addr s.srf, left.cint, top.cint, right.cint, bottom.cint, clr)
+  of Chr4r: schr4rRect(addr s.srf, left.cint, top.cint, right.cint, bottom.cint, clr)
+
+proc blit(s: TestSurface; dx, dy, w, h: int; src: TestSurface; sx, sy: int) =
+  case s.kind
+  of Bmp16: sbmp16Blit(addr s.srf, dx.cint, dy.cint, w.cuint, h.cuint, addr src.srf, sx.cint, sy.cint)
+  of Bmp8: sbmp8Blit(addr s.srf, dx.cint, dy.cint, w.cuint, h.cuint, addr src.srf, sx.cint, sy.cint)
+  of Chr4c: schr4cBlit(addr s.srf, dx.cint, dy.cint, w.cuint, h.cuint, addr src.srf, sx.cint, sy.cint)
+  of Chr4r: raiseAssert("chr4r surfaces have no blitter")
+
+proc floodfill(s: TestSurface; x, y: int; clr: uint32; stack: var seq[FloodSpan]): bool =
+  ## Uses the shared work buffer if `stack` is empty.
+  let p = if stack.len > 0: addr stack[0] else: nil
+  let n = stack.len.cuint
+  case s.kind
+  of Bmp16: sbmp16FloodfillEx(addr s.srf, x.cint, y.cint, clr, p, n)
+  of Bmp8: sbmp8FloodfillEx(addr s.srf, x.cint, y.cint, clr, p, n)
+  of Chr4c: schr4cFloodfillEx(addr s.srf, x.cint, y.cint, clr, p, n)
+  of Chr4r: schr4rFloodfillEx(addr s.srf, x.cint, y.cint, clr, p, n)
+
+proc refFloodfill(s: TestSurface; x, y: int; clr: uint32) =
+  ## 4-connected breadth-first fill, one pixel at a time.
+  let old = s[x, y]
+  if old == clr: return
+  var queue = @[(x, y)]
+  s[x, y] = clr
+  var i = 0
+  while i < queue.len:
+    let (px, py) = queue[i]
+    inc i
+    for (nx, ny) in [(px-1, py), (px+1, py), (px, py-1), (px, py+1)]:
+      if nx in 0..<s.w and ny in 0..<s.h and s[nx, ny] == old:
+        s[nx, ny] = clr
+        queue.add (nx, ny)
+
+var r = initRand(1)
+
+proc randomSize(kind: Kind): (int, int) =
+  if kind in {Chr4c, Chr4r}: (8 * r.rand(1..32), 8 * r.rand(1..32))
+  else: (r.rand(1..256), r.rand(1..200))
+
+proc randomContent(s: TestSurface; numColors: int) =
+  ## A few overlapping rectangles, sometimes with noise on top.
+  for y in 0..<s.h:
+    for x in 0..<s.w:
+      s[x, y] = 0
+  for _ in 0 ..< r.rand(30):
+    let (x0, y0) = (r.rand(s.w - 1), r.rand(s.h - 1))
+    let (x1, y1) = (min(s.w, x0 + r.rand(1..s.w div 2 + 1)), min(s.h, y0 + r.rand(1..s.h div 2 + 1)))
+    let c = r.rand(numColors - 1).uint32
+    for y in y0..<y1:
+      for x in x0..<x1:
+        s[x, y] = c
+  if r.rand(3) > 0:
+    for _ in 0 ..< r.rand(s.w * s.h div 4):
+      s[r.rand(s.w - 1), r.rand(s.h - 1)] = r.rand(numColors - 1).uint32
+
+var failures = 0
+
+template check(cond: bool; msg: string) =
+  if not cond:
+    echo "FAIL: ", msg
+    inc failures
+
+proc samePixels(a, b: TestSurface): bool =
+  for y in 0..<a.h:
+    for x in 0..<a.w:
+      if a[x, y] != b[x, y]: return false
+  true
+
+# Floodfill: when it succeeds it must match the reference exactly, and when the
+# work buffer runs out it may leave parts unfilled, but must not touch anything else.
+
+var overflows = 0
+for i in 0..<2000:
+  let kind = r.sample([Bmp16, Bmp8, Chr4c, Chr4r])
+  let (w, h) = randomSize(kind)
+  let s = newTestSurface(kind, w, h)
+  let ncol = r.rand(2..4)
+  s.randomContent(ncol)
+  let clr = uint32(if r.rand(2) > 0: r.rand(ncol) else: r.rand(numColors(kind) - 1))
+  let (x, y) = (r.rand(w - 1), r.rand(h - 1))
+  let before = s.clone()
+  let expected = s.clone()
+  expected.refFloodfill(x, y, clr)
+  var stack = newSeq[FloodSpan](if r.rand(1) == 0: 0 else: r.rand(16..64))
+  let desc = $kind & " " & $w & "x" & $h & " at " & $x & "," & $y & " (test " & $i & ")"
+  if s.floodfill(x, y, clr, stack):
+    check(s.mem == expected.mem, "floodfill differs from the reference on " & desc)
+  else:
+    inc overflows
+    var stray = false
+    for py in 0..<h:
+      for px in 0..<w:
+        if s[px, py] != before[px, py] and s[px, py] != expected[px, py]:
+          stray = true
+    check(not stray, "floodfill overflowed and touched pixels outside the area on " & desc)
+  check(s.guardsOk, "floodfill wrote outside the surface on " & desc)
+
+echo overflows, " of 2000 floodfills ran out of work buffer"
+
+block:
+  # A grid of single-pixel dots splits every other row into 120 short spans,
+  # so a fullscreen fill needs far more than the shared buffer.
+  let s = newTestSurface(Bmp8, 240, 160)
+  for y in 0..<160:
+    for x in 0..<240:
+      s[x, y] = (if x mod 2 == 1 and y mod 2 == 1: 1 else: 0)
+  let expected = s.clone()
+  expected.refFloodfill(0, 0, 2)
+  let big = s.clone()
+  check(not sbmp8Floodfill(addr s.srf, 0, 0, 2), "dotted fullscreen floodfill should report that it ran out of space")
+  var stack = newSeq[FloodSpan](8192)
+  check(big.floodfill(0, 0, 2, stack), "dotted fullscreen floodfill should fit in 8192 spans")
+  check(big.mem == expected.mem, "dotted fullscreen floodfill differs from the reference")
+
+# hline, rect and blit against the same operations done with plot.
+
+for i in 0..<3000:
+  let kind = r.sample([Bmp16, Bmp8, Chr4c, Chr4r])
+  let (w, h) = randomSize(kind)
+  let s = newTestSurface(kind, w, h)
+  s.randomContent(16)
+  let clr = r.rand(numColors(kind) - 1).uint32
+  let expected = s.clone()
+  var desc = $kind & " " & $w & "x" & $h & " (test " & $i & ")"
+
+  case r.rand(2)
+  of 0:
+    let (x1, x2, y) = (r.rand(w - 1), r.rand(w - 1), r.rand(h - 1))
+    desc = "hline " & $x1 & ".." & $x2 & " on " & desc
+    s.hline(x1, y, x2, clr)
+    for x in min(x1, x2)..max(x1, x2):
+      expected[x, y] = clr
+  of 1:
+    let (left, right, top, bottom) = (r.rand(w), r.rand(w), r.rand(h), r.rand(h))
+    desc = "rect " & $left & "," & $top & "," & $right & "," & $bottom & " on " & desc
+    s.rect(left, top, right, bottom, clr)
+    for y in min(top, bottom) ..< max(top, bottom):
+      for x in min(left, right) ..< max(left, right):
+        expected[x, y] = clr
+  else:
+    if kind == Chr4r: continue
+    let (sw, sh) = randomSize(kind)
+    let src = newTestSurface(kind, sw, sh)
+    src.randomContent(16)
+    let (dx, dy) = (r.rand(-40 .. w + 20), r.rand(-40 .. h + 20))
+    let (sx, sy) = (r.rand(-40 .. sw + 20), r.rand(-40 .. sh + 20))
+    let (bw, bh) = (r.rand(300), r.rand(220))
+    desc = "blit " & $bw & "x" & $bh & " from " & $sx & "," & $sy & " to " & $dx & "," & $dy & " on " & desc
+    s.blit(dx, dy, bw, bh, src, sx, sy)
+    for y in 0..<bh:
+      for x in 0..<bw:
+        if dx+x in 0..<w and dy+y in 0..<h and sx+x in 0..<sw and sy+y in 0..<sh:
+          expected[dx+x, dy+y] = src[sx+x, sy+y]
+
+  check(samePixels(s, expected), desc & " differs from the reference")
+  check(s.guardsOk, desc & " wrote outside the surface")
+
+# Speed, in pixels per second.
+
+proc bench(name: string; pixelsPerRep: int; body: proc ()) =
+  var reps = 0
+  let start = getMonoTime()
+  var elapsed: Duration
+  while true:
+    body()
+    inc reps
+    elapsed = getMonoTime() - start
+    if elapsed.inMilliseconds >= 200: break
+  let rate = (pixelsPerRep * reps).float / (elapsed.inNanoseconds.float / 1e9) / 1e6
+  echo alignLeft(name, 36), align(formatFloat(rate, ffDecimal, 1) & " Mpx/s", 14)
+
+echo ""
+for kind in [Bmp16, Bmp8, Chr4c, Chr4r]:
+  let (w, h) = if kind in {Chr4c, Chr4r}: (256, 256) else: (240, 160)
+  let a = newTestSurface(kind, w, h)
+  let b = newTestSurface(kind, w, h)
+  b.randomContent(16)
+  var shared: seq[FloodSpan]
+  bench($kind & " rect", 200 * 120, proc () =
+    a.rect(3, 3, 203, 123, 1))
+  if kind != Chr4r:
+    bench($kind & " blit (aligned)", 200 * 120, proc () =
+      a.blit(8, 3, 200, 120, b, 8, 5))
+    bench($kind & " blit (misaligned)", 200 * 120, proc () =
+      a.blit(3, 3, 200, 120, b, 6, 5))
+  bench($kind & " floodfill (around a bar)", w * h - 20 * (h - 50), proc () =
+    a.rect(0, 0, w, h, 1)
+    a.rect(40, 40, 60, h - 10, 2)
+    discard a.floodfill(0, 0, 3, shared))
+
+doAssert(failures == 0, $failures & " failures")
+echo "ok"